@@ -29,6 +29,7 @@
 void Camera::setPitch(qreal pitch)
 {
     m_pitch = qBound(qreal(-30), pitch, qreal(30));
+    m_customViewMatrix = false;
     m_matrixDirty = true;
 }
 
@@ -46,12 +47,14 @@ qreal Camera::fov() const { return m_fov; }
 void Camera::setYaw(qreal yaw)
 {
     m_yaw = yaw;
+    m_customViewMatrix = false;
     m_matrixDirty = true;
 }
 
 void Camera::setPos(const QVector3D &pos)
 {
     m_pos = pos;
+    m_customViewMatrix = false;
     m_matrixDirty = true;
 }
 
@@ -64,6 +67,14 @@ void Camera::setFov(qreal fov)
 void Camera::setTime(qreal time)
 {
     m_time = time;
+    m_customViewMatrix = false;
+    m_matrixDirty = true;
+}
+
+void Camera::setViewMatrix(const QMatrix4x4 &matrix)
+{
+    m_viewMatrix = matrix;
+    m_customViewMatrix = true;
     m_matrixDirty = true;
 }
 
@@ -114,11 +125,13 @@ void Camera::updateMatrix() const
 
     m_matrixDirty = false;
 
-    QMatrix4x4 m;
-    m *= fromRotation(m_yaw - 180, Qt::YAxis);
-    m.translate(-m_pos.x(), -viewPos().y(), -m_pos.z());
-    m = fromRotation(m_pitch, Qt::XAxis) * m;
-    m_viewMatrix = m;
+    if (!m_customViewMatrix) {
+        QMatrix4x4 m;
+        m *= fromRotation(m_yaw - 180, Qt::YAxis);
+        m.translate(-m_pos.x(), -viewPos().y(), -m_pos.z());
+        m = fromRotation(m_pitch, Qt::XAxis) * m;
+        m_viewMatrix = m;
+    }
 
     float fovAngle = m_fov * 2 * 3.14159 / 360.0;
 
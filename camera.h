@@ -40,6 +40,7 @@ public:
         , m_time(0)
         , m_view(100, 100)
         , m_nearClipPlane(QVector4D(0, 0, -1, -m_zNear))
+        , m_customViewMatrix(false)
         , m_matrixDirty(true)
     {
     }
@@ -60,7 +61,7 @@ public:
     qreal zFar() const { return m_zFar; }
 
     qreal height() const { return m_height; }
-    void setHeight(qreal height) { m_height = height; m_matrixDirty = true; }
+    void setHeight(qreal height) { m_height = height; m_customViewMatrix = false; m_matrixDirty = true; }
 
     QVector4D nearClipPlane() const { return m_nearClipPlane; }
     void setNearClipPlane(const QVector4D &clipPlane) { m_nearClipPlane = clipPlane; m_matrixDirty = true; }
@@ -77,6 +78,9 @@ public:
     void setFov(qreal fov);
     void setTime(qreal time);
 
+    // overrides the view matrix derived from yaw, pitch and position until one of those changes
+    void setViewMatrix(const QMatrix4x4 &matrix);
+
     const QMatrix4x4 &viewProjectionMatrix() const;
     const QMatrix4x4 &viewMatrix() const;
     const QMatrix4x4 &projectionMatrix() const;
@@ -101,6 +105,8 @@ private:
     QVector3D m_pos;
     QVector4D m_nearClipPlane;
 
+    bool m_customViewMatrix;
+
     mutable bool m_matrixDirty;
     mutable QMatrix4x4 m_viewMatrix;
     mutable QMatrix4x4 m_viewProjectionMatrix;
@@ -23,9 +23,26 @@
 #include "common.h"
 
 #include "camera.h"
+#include "glstate.h"
 
 #include <QColor>
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QThreadStorage>
+#include <QTime>
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SWIZZLE_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SWIZZLE_NEON
+#endif
 
 namespace {
     QByteArray drawTextureVertexSrc =
@@ -104,15 +121,13 @@ void drawRect(const QRectF &target, const QSizeF &viewport, const QColor &color,
         va, vb, vd, vd, vb, vc
     };
 
-    program->bind();
+    GLState::useProgram(program);
     program->setUniformValue(colorUniform, color);
 
-    program->enableAttributeArray(vertexAttr);
+    GLState::setAttributeArrays(vertexAttr);
     program->setAttributeArray(vertexAttr, vertexCoords);
 
     glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    program->disableAttributeArray(vertexAttr);
 }
 
 void drawConvexSolid(const Camera &camera, const QVector<QVector3D> &outline, const QColor &color)
@@ -130,23 +145,21 @@ void drawConvexSolid(const Camera &camera, const QVector<QVector3D> &outline, co
     }
 
     if (color.alpha() != 255) {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        GLState::enable(GL_BLEND);
+        GLState::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
 
-    program->bind();
+    GLState::useProgram(program);
     program->setUniformValue(matrixUniform, camera.viewProjectionMatrix());
     program->setUniformValue(colorUniform, color);
 
-    program->enableAttributeArray(vertexAttr);
+    GLState::setAttributeArrays(vertexAttr);
     program->setAttributeArray(vertexAttr, outline.constData());
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, outline.size());
 
-    program->disableAttributeArray(vertexAttr);
-
     if (color.alpha() != 255)
-        glDisable(GL_BLEND);
+        GLState::disable(GL_BLEND);
 }
 
 void drawTexture(const QRectF &target, const QSizeF &viewport, GLuint texture, qreal alpha, const QRectF &source)
@@ -199,21 +212,17 @@ void drawTexture(const QRectF &target, const QSizeF &viewport, GLuint texture, q
         ta, tb, td, td, tb, tc
     };
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    GLState::activeTexture(GL_TEXTURE0);
+    GLState::bindTexture(texture);
 
-    program->bind();
+    GLState::useProgram(program);
     program->setUniformValue(opacityUniform, GLfloat(alpha));
 
-    program->enableAttributeArray(vertexAttr);
+    GLState::setAttributeArrays(vertexAttr, texCoordAttr);
     program->setAttributeArray(vertexAttr, vertexCoords);
-    program->enableAttributeArray(texCoordAttr);
     program->setAttributeArray(texCoordAttr, texCoords);
 
     glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    program->disableAttributeArray(vertexAttr);
-    program->disableAttributeArray(texCoordAttr);
 }
 
 int isPowerOfTwo (unsigned int x)
@@ -238,16 +247,132 @@ bool canUseMipmaps(const QSize &size)
     return supportsNonPowerOfTwoMipmaps || (isPowerOfTwo(size.width()) && isPowerOfTwo(size.height()));
 }
 
+namespace {
+#ifndef GL_BGRA_EXT
+#define GL_BGRA_EXT 0x80E1
+#endif
+
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+
+    struct UploadSupport
+    {
+        // QImage::Format_ARGB32 scanlines can be passed to GL without conversion
+        bool bgra;
+        // sub rectangles can be read straight out of a wider scanline
+        bool rowLength;
+
+        GLenum internalFormat;
+        GLenum format;
+    };
+
+    const UploadSupport &uploadSupport()
+    {
+        static UploadSupport support;
+        static bool initialized = false;
+        if (initialized)
+            return support;
+
+        QOpenGLContext *ctx = QOpenGLContext::currentContext();
+
+#ifdef QT_OPENGL_ES_2
+        support.bgra = ctx->hasExtension("GL_EXT_texture_format_BGRA8888");
+        support.rowLength = ctx->hasExtension("GL_EXT_unpack_subimage") || ctx->format().majorVersion() >= 3;
+#else
+        Q_UNUSED(ctx);
+        support.bgra = true;
+        support.rowLength = true;
+#endif
+
+        // ARGB32 is only laid out as BGRA bytes on little endian machines
+        if (Q_BYTE_ORDER != Q_LITTLE_ENDIAN)
+            support.bgra = false;
+
+        support.format = support.bgra ? GL_BGRA_EXT : GL_RGBA;
+#ifdef QT_OPENGL_ES_2
+        // the BGRA8888 extension requires matching internal and external formats
+        support.internalFormat = support.format;
+#else
+        support.internalFormat = GL_RGBA;
+#endif
+
+        printf("Texture uploads: %s, row length: %s\n", support.bgra ? "BGRA" : "RGBA swizzle",
+               support.rowLength ? "yes" : "no");
+
+        initialized = true;
+        return support;
+    }
+
+    QThreadStorage<QByteArray> stagingBuffers;
+
+    uchar *stagingBuffer(int size)
+    {
+        QByteArray &buffer = stagingBuffers.localData();
+        if (buffer.size() < size)
+            buffer.resize(size);
+        return reinterpret_cast<uchar *>(buffer.data());
+    }
+
+    void swizzleToRgba(const QRgb *src, uchar *dst, int count)
+    {
+        int i = 0;
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        quint32 *out = reinterpret_cast<quint32 *>(dst);
+
+#if defined(SWIZZLE_SSE2)
+        const __m128i alphaGreen = _mm_set1_epi32(0xff00ff00);
+        const __m128i redBlue = _mm_set1_epi32(0x00ff00ff);
+        for (; i + 4 <= count; i += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i rotated = _mm_or_si128(_mm_slli_epi32(pixels, 16), _mm_srli_epi32(pixels, 16));
+            pixels = _mm_or_si128(_mm_and_si128(pixels, alphaGreen), _mm_and_si128(rotated, redBlue));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), pixels);
+        }
+#elif defined(SWIZZLE_NEON)
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t pixels = vld4q_u8(reinterpret_cast<const uint8_t *>(src + i));
+            uint8x16_t blue = pixels.val[0];
+            pixels.val[0] = pixels.val[2];
+            pixels.val[2] = blue;
+            vst4q_u8(reinterpret_cast<uint8_t *>(out + i), pixels);
+        }
+#endif
+
+        for (; i < count; ++i) {
+            quint32 p = src[i];
+            out[i] = (p & 0xff00ff00) | ((p << 16) & 0x00ff0000) | ((p >> 16) & 0x000000ff);
+        }
+#else
+        for (; i < count; ++i) {
+            *dst++ = qRed(src[i]);
+            *dst++ = qGreen(src[i]);
+            *dst++ = qBlue(src[i]);
+            *dst++ = qAlpha(src[i]);
+        }
+#endif
+    }
+}
+
 GLuint generateTexture(const QImage &image, bool mipmaps, bool repeat)
 {
-    mipmaps = mipmaps && canUseMipmaps(image.size());
+    GLuint id = allocateTexture(image.size(), mipmaps, repeat);
+    updateSubImage(id, image, image.rect(), mipmaps);
+    return id;
+}
+
+GLuint allocateTexture(const QSize &size, bool mipmaps, bool repeat)
+{
+    mipmaps = mipmaps && canUseMipmaps(size);
+
+    const UploadSupport &support = uploadSupport();
 
     GLuint id;
     glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGBA, image.width(), image.height(), 0, GL_RGBA,
+    GLState::bindTexture(id);
+    glTexImage2D(GL_TEXTURE_2D,  0, support.internalFormat, size.width(), size.height(), 0, support.format,
         GL_UNSIGNED_BYTE, 0);
-    updateSubImage(id, image, image.rect(), mipmaps);
 
     if (mipmaps) {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -263,35 +388,241 @@ GLuint generateTexture(const QImage &image, bool mipmaps, bool repeat)
     return id;
 }
 
-void updateSubImage(GLuint texture, const QImage &image, const QRect &rect, bool mipmaps)
+GLenum textureUploadFormat()
 {
-    mipmaps = mipmaps && canUseMipmaps(image.size());
+    return uploadSupport().format;
+}
+
+bool hasUploadLayout(const QImage &image)
+{
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return true;
+    default:
+        return false;
+    }
+}
 
-    QVector<uchar> data;
-    for (int i = rect.y(); i <= rect.bottom(); ++i) {
-        QRgb *p = (QRgb *)image.scanLine(i);
-        for (int j = rect.x(); j <= rect.right(); ++j) {
-            data << qRed(p[j]);
-            data << qGreen(p[j]);
-            data << qBlue(p[j]);
-            data << qAlpha(p[j]);
+void copyForUpload(const QImage &image, const QRect &rect, uchar *dst)
+{
+    const UploadSupport &support = uploadSupport();
+
+    const int stride = image.bytesPerLine() / 4;
+    const QRgb *first = reinterpret_cast<const QRgb *>(image.constScanLine(rect.y())) + rect.x();
+
+    for (int i = 0; i < rect.height(); ++i) {
+        const QRgb *src = first + i * stride;
+        uchar *row = dst + i * rect.width() * 4;
+        if (support.bgra)
+            memcpy(row, src, rect.width() * 4);
+        else
+            swizzleToRgba(src, row, rect.width());
+    }
+}
+
+namespace {
+    void uploadRect(GLuint texture, const QImage &image, const QRect &rect, const QPoint &pos, int level)
+    {
+        const UploadSupport &support = uploadSupport();
+
+        const int stride = image.bytesPerLine() / 4;
+        const QRgb *first = reinterpret_cast<const QRgb *>(image.constScanLine(rect.y())) + rect.x();
+
+        const uchar *pixels;
+        bool rowLength = false;
+
+        if (support.bgra && (rect.width() == stride || rect.height() == 1)) {
+            // the scanlines are already contiguous
+            pixels = reinterpret_cast<const uchar *>(first);
+        } else if (support.bgra && support.rowLength) {
+            pixels = reinterpret_cast<const uchar *>(first);
+            rowLength = true;
+        } else {
+            uchar *staging = stagingBuffer(rect.width() * rect.height() * 4);
+            copyForUpload(image, rect, staging);
+            pixels = staging;
         }
+
+        GLState::bindTexture(texture);
+
+        if (rowLength)
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+
+        glTexSubImage2D(GL_TEXTURE_2D,  level, pos.x(), pos.y(), rect.width(), rect.height(), support.format,
+            GL_UNSIGNED_BYTE, pixels);
+
+        if (rowLength)
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+}
+
+void updateSubImage(GLuint texture, const QImage &image, const QRect &rect, bool mipmaps, int level)
+{
+    mipmaps = mipmaps && canUseMipmaps(image.size());
+
+    if (!hasUploadLayout(image)) {
+        updateSubImage(texture, image.convertToFormat(QImage::Format_ARGB32), rect, mipmaps, level);
+        return;
     }
 
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexSubImage2D(GL_TEXTURE_2D,  0, rect.x(), rect.y(), rect.width(), rect.height(), GL_RGBA,
-        GL_UNSIGNED_BYTE, data.constData());
+    uploadRect(texture, image, rect, rect.topLeft(), level);
 
     if (mipmaps)
         QOpenGLFunctions(QOpenGLContext::currentContext()).glGenerateMipmap(GL_TEXTURE_2D);
 }
 
-QOpenGLShaderProgram *generateShaderProgram(QObject *parent, QByteArray vsrc, QByteArray fsrc)
+void updateSubImage(GLuint texture, const QImage &image, const QPoint &pos, int level)
+{
+    if (!hasUploadLayout(image)) {
+        updateSubImage(texture, image.convertToFormat(QImage::Format_ARGB32), pos, level);
+        return;
+    }
+
+    uploadRect(texture, image, image.rect(), pos, level);
+}
+
+namespace {
+    typedef void (QOPENGLF_APIENTRYP GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, GLvoid *binary);
+    typedef void (QOPENGLF_APIENTRYP ProgramBinary)(GLuint program, GLenum binaryFormat, const GLvoid *binary, GLint length);
+    typedef void (QOPENGLF_APIENTRYP ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+
+    const GLenum programBinaryLength = 0x8741;
+    const GLenum numProgramBinaryFormats = 0x87FE;
+    const GLenum programBinaryRetrievableHint = 0x8257;
+
+    GetProgramBinary getProgramBinary = 0;
+    ProgramBinary programBinary = 0;
+    ProgramParameteri programParameteri = 0;
+
+    QString shaderCacheDir;
+    QByteArray driverKey;
+
+    bool resolveProgramBinaries()
+    {
+        static bool resolved = false;
+        if (resolved)
+            return programBinary != 0;
+        resolved = true;
+
+        if (!useShaderCache())
+            return false;
+
+        QOpenGLContext *ctx = QOpenGLContext::currentContext();
+
+        if (ctx->hasExtension("GL_OES_get_program_binary")) {
+            getProgramBinary = reinterpret_cast<GetProgramBinary>(ctx->getProcAddress("glGetProgramBinaryOES"));
+            programBinary = reinterpret_cast<ProgramBinary>(ctx->getProcAddress("glProgramBinaryOES"));
+        } else if (ctx->hasExtension("GL_ARB_get_program_binary")) {
+            getProgramBinary = reinterpret_cast<GetProgramBinary>(ctx->getProcAddress("glGetProgramBinary"));
+            programBinary = reinterpret_cast<ProgramBinary>(ctx->getProcAddress("glProgramBinary"));
+            programParameteri = reinterpret_cast<ProgramParameteri>(ctx->getProcAddress("glProgramParameteri"));
+        }
+
+        GLint formats = 0;
+        if (getProgramBinary && programBinary)
+            glGetIntegerv(numProgramBinaryFormats, &formats);
+
+        if (formats <= 0) {
+            getProgramBinary = 0;
+            programBinary = 0;
+            programParameteri = 0;
+            return false;
+        }
+
+        shaderCacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/shaders");
+        QDir().mkpath(shaderCacheDir);
+
+        // binaries are only valid for the driver that produced them
+        driverKey += reinterpret_cast<const char *>(glGetString(GL_VENDOR));
+        driverKey += reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+        driverKey += reinterpret_cast<const char *>(glGetString(GL_VERSION));
+
+        return true;
+    }
+
+    QString shaderCachePath(const QByteArray &vsrc, const QByteArray &fsrc, const QList<QByteArray> &attributes)
+    {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(driverKey);
+        hash.addData(vsrc);
+        hash.addData(fsrc);
+        for (int i = 0; i < attributes.size(); ++i)
+            hash.addData(attributes.at(i));
+
+        return shaderCacheDir + QLatin1Char('/') + QString::fromLatin1(hash.result().toHex());
+    }
+
+    bool loadProgramBinary(QOpenGLShaderProgram *program, const QString &path)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+
+        QByteArray data = file.readAll();
+        if (data.size() <= int(sizeof(GLenum)))
+            return false;
+
+        GLenum format;
+        memcpy(&format, data.constData(), sizeof(GLenum));
+
+        programBinary(program->programId(), format, data.constData() + sizeof(GLenum), data.size() - sizeof(GLenum));
+
+        // with no shaders added, link() only checks the status of the loaded binary
+        return program->link();
+    }
+
+    void storeProgramBinary(QOpenGLShaderProgram *program, const QString &path)
+    {
+        QOpenGLFunctions functions(QOpenGLContext::currentContext());
+
+        GLint length = 0;
+        functions.glGetProgramiv(program->programId(), programBinaryLength, &length);
+        if (length <= 0)
+            return;
+
+        QByteArray data(sizeof(GLenum) + length, 0);
+
+        GLenum format = 0;
+        getProgramBinary(program->programId(), length, &length, &format, data.data() + sizeof(GLenum));
+        memcpy(data.data(), &format, sizeof(GLenum));
+        data.resize(sizeof(GLenum) + length);
+
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly))
+            file.write(data);
+    }
+}
+
+QOpenGLShaderProgram *generateShaderProgram(QObject *parent, QByteArray vsrc, QByteArray fsrc,
+                                            const QList<QByteArray> &attributes)
 {
+    QTime time;
+    time.start();
+
+    ShaderStats &stats = shaderStats();
+    ++stats.programs;
+
     QOpenGLShaderProgram *program = new QOpenGLShaderProgram(parent);
 
+    bool cache = resolveProgramBinaries();
+    QString path;
+
+    if (cache) {
+        path = shaderCachePath(vsrc, fsrc, attributes);
+        if (loadProgramBinary(program, path)) {
+            ++stats.cached;
+            stats.msecs += time.elapsed();
+            return program;
+        }
+
+        // a stale or rejected binary leaves the program unusable, start over
+        delete program;
+        program = new QOpenGLShaderProgram(parent);
+    }
+
     QOpenGLShader *vshader = new QOpenGLShader(QOpenGLShader::Vertex, program);
-    vshader->compileSourceCode(vsrc);
     if (!vshader->compileSourceCode(vsrc))
         qFatal("Error in vertex src:\n%s\n", vsrc.constData());
 
@@ -301,9 +632,22 @@ QOpenGLShaderProgram *generateShaderProgram(QObject *parent, QByteArray vsrc, QB
 
     program->addShader(vshader);
     program->addShader(fshader);
+
+    // fixed locations let variants of a program share vertex array objects
+    for (int i = 0; i < attributes.size(); ++i)
+        program->bindAttributeLocation(attributes.at(i).constData(), i);
+
+    if (cache && programParameteri)
+        programParameteri(program->programId(), programBinaryRetrievableHint, GL_TRUE);
+
     if (!program->link())
         qFatal("Error linking:\n%s\n%s\n", vsrc.constData(), fsrc.constData());
 
+    if (cache)
+        storeProgramBinary(program, path);
+
+    stats.msecs += time.elapsed();
+
     return program;
 }
 
@@ -351,6 +695,29 @@ QVector3D offsets[][4] =
 
 }
 
+// Replaces LIGHTS_DECLARATION with a lights array of the given size and
+// LIGHTS_LOOP with one copy of loopBody per light, with lights[i] spelled
+// out, so that the shader has neither a loop counter nor a branch on the
+// number of lights in the zone.
+QByteArray specializeLights(QByteArray source, const QByteArray &loopBody, int count)
+{
+    QByteArray declaration;
+    if (count > 0)
+        declaration = "uniform highp vec3 lights[" + QByteArray::number(count) + "];\n";
+
+    QByteArray loop;
+    for (int i = 0; i < count; ++i) {
+        QByteArray iteration = loopBody;
+        iteration.replace("lights[i]", "lights[" + QByteArray::number(i) + "]");
+        loop += "    {\n" + iteration + "    }\n";
+    }
+
+    source.replace("LIGHTS_DECLARATION", declaration);
+    source.replace("LIGHTS_LOOP", loop);
+
+    return source;
+}
+
 QVector<QVector3D> tile(int x, int z, TileType type, QVector3D scale, QVector3D dim)
 {
     QVector<QVector3D> result;
@@ -381,3 +748,160 @@ bool fpsDebug()
     return fpsDebug;
 }
 
+bool benchmarkMode()
+{
+    static bool initialized = false;
+    static bool benchmark = false;
+    if (!initialized) {
+        benchmark = QCoreApplication::arguments().contains(QLatin1String("--benchmark"));
+        initialized = true;
+    }
+    return benchmark;
+}
+
+bool useVertexArrayObjects()
+{
+    static bool initialized = false;
+    static bool vertexArrays = true;
+    if (!initialized) {
+        vertexArrays = !QCoreApplication::arguments().contains(QLatin1String("--no-vertex-arrays"));
+        initialized = true;
+    }
+    return vertexArrays;
+}
+
+bool useShaderCache()
+{
+    static bool initialized = false;
+    static bool shaderCache = true;
+    if (!initialized) {
+        shaderCache = !QCoreApplication::arguments().contains(QLatin1String("--no-shader-cache"));
+        initialized = true;
+    }
+    return shaderCache;
+}
+
+bool useBakedLighting()
+{
+    static bool initialized = false;
+    static bool baked = false;
+    if (!initialized) {
+        baked = QCoreApplication::arguments().contains(QLatin1String("--baked-lighting"));
+        initialized = true;
+    }
+    return baked;
+}
+
+bool useAsyncUploads()
+{
+    static bool initialized = false;
+    static bool async = true;
+    if (!initialized) {
+        async = !QCoreApplication::arguments().contains(QLatin1String("--sync-uploads"));
+        initialized = true;
+    }
+    return async;
+}
+
+MipmapMode mipmapMode()
+{
+    static bool initialized = false;
+    static MipmapMode mode = RegionMipmaps;
+    if (!initialized) {
+        const QStringList arguments = QCoreApplication::arguments();
+        if (arguments.contains(QLatin1String("--mipmaps=full")))
+            mode = FullMipmaps;
+        else if (arguments.contains(QLatin1String("--mipmaps=lazy")))
+            mode = LazyMipmaps;
+        initialized = true;
+    }
+    return mode;
+}
+
+qint64 uploadBudgetBytes()
+{
+    static bool initialized = false;
+    static qint64 budget = 8192 * 1024;
+    if (!initialized) {
+        const QString option = QLatin1String("--upload-budget=");
+        foreach (const QString &argument, QCoreApplication::arguments()) {
+            if (argument.startsWith(option))
+                budget = qMax(1, argument.mid(option.size()).toInt()) * qint64(1024);
+        }
+        initialized = true;
+    }
+    return budget;
+}
+
+qint64 textureBudgetBytes()
+{
+    static bool initialized = false;
+    static qint64 budget = qint64(192) * 1024 * 1024;
+    if (!initialized) {
+        const QString option = QLatin1String("--texture-budget=");
+        foreach (const QString &argument, QCoreApplication::arguments()) {
+            if (argument.startsWith(option))
+                budget = qMax(1, argument.mid(option.size()).toInt()) * qint64(1024 * 1024);
+        }
+        initialized = true;
+    }
+    return budget;
+}
+
+int uploadBudgetMsecs()
+{
+    static bool initialized = false;
+    static int budget = 4;
+    if (!initialized) {
+        const QString option = QLatin1String("--upload-time-budget=");
+        foreach (const QString &argument, QCoreApplication::arguments()) {
+            if (argument.startsWith(option))
+                budget = qMax(1, argument.mid(option.size()).toInt());
+        }
+        initialized = true;
+    }
+    return budget;
+}
+
+void FrameStats::reset()
+{
+    frames = 0;
+    planBuilds = 0;
+    surfacesDrawn = 0;
+    surfacesCulled = 0;
+    glStateChanges = 0;
+    glStateChangesSkipped = 0;
+    uniformUploads = 0;
+    uniformUploadsSkipped = 0;
+    depthResetPixels = 0;
+    uploadBytes = 0;
+    surfaceUploads = 0;
+    surfaceUploadsDeferred = 0;
+    texturePoolHits = 0;
+    texturePoolMisses = 0;
+    texturesEvicted = 0;
+    frameCallbacks = 0;
+    frameCallbacksHeld = 0;
+    frameCallbacksTimed = 0;
+    surfaceFrameCallbacks.clear();
+    surfaceUploadBytes.clear();
+}
+
+FrameStats &frameStats()
+{
+    static FrameStats stats;
+    return stats;
+}
+
+void addUploadBytes(const void *surface, qint64 bytes)
+{
+    FrameStats &stats = frameStats();
+    stats.uploadBytes += bytes;
+    stats.surfaceUploadBytes[surface] += bytes;
+}
+
+ShaderStats &shaderStats()
+{
+    static ShaderStats stats;
+    return stats;
+}
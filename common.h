@@ -23,6 +23,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <QHash>
 #include <QImage>
 
 #include <QOpenGLFunctions>
@@ -37,9 +38,22 @@ void drawRect(const QRectF &target, const QSizeF &viewport, const QColor &color,
 void drawConvexSolid(const Camera &camera, const QVector<QVector3D> &outline, const QColor &color);
 
 GLuint generateTexture(const QImage &image, bool mipmaps = true, bool repeat = true);
-void updateSubImage(GLuint texture, const QImage &image, const QRect &rect, bool mipmaps = true);
+GLuint allocateTexture(const QSize &size, bool mipmaps = true, bool repeat = true);
+void updateSubImage(GLuint texture, const QImage &image, const QRect &rect, bool mipmaps = true, int level = 0);
 
-QOpenGLShaderProgram *generateShaderProgram(QObject *parent, QByteArray vsrc, QByteArray fsrc);
+// uploads all of image into texture with its top left corner at pos
+void updateSubImage(GLuint texture, const QImage &image, const QPoint &pos, int level = 0);
+
+// pixel format of texture uploads and the matching conversion of a 32 bit image rect into packed rows
+GLenum textureUploadFormat();
+
+// whether image scanlines are laid out as QRgb, other images are converted to ARGB32 first
+bool hasUploadLayout(const QImage &image);
+void copyForUpload(const QImage &image, const QRect &rect, uchar *dst);
+
+QOpenGLShaderProgram *generateShaderProgram(QObject *parent, QByteArray vsrc, QByteArray fsrc,
+                                            const QList<QByteArray> &attributes = QList<QByteArray>());
+QByteArray specializeLights(QByteArray source, const QByteArray &loopBody, int count);
 
 enum TileType
 {
@@ -56,5 +70,65 @@ QVector<QVector3D> tile(int x, int z, TileType type, QVector3D scale = QVector3D
 bool canUseMipmaps(const QSize &size);
 bool useSimpleShading();
 bool fpsDebug();
+bool benchmarkMode();
+bool useVertexArrayObjects();
+bool useShaderCache();
+bool useBakedLighting();
+bool useAsyncUploads();
+
+enum MipmapMode
+{
+    FullMipmaps,
+    RegionMipmaps,
+    LazyMipmaps
+};
+
+MipmapMode mipmapMode();
+
+qint64 uploadBudgetBytes();
+int uploadBudgetMsecs();
+qint64 textureBudgetBytes();
+
+struct FrameStats
+{
+    FrameStats() { reset(); }
+
+    void reset();
+
+    int frames;
+    int planBuilds;
+    int surfacesDrawn;
+    int surfacesCulled;
+    int glStateChanges;
+    int glStateChangesSkipped;
+    int uniformUploads;
+    int uniformUploadsSkipped;
+    qint64 depthResetPixels;
+    qint64 uploadBytes;
+    int surfaceUploads;
+    int surfaceUploadsDeferred;
+    int texturePoolHits;
+    int texturePoolMisses;
+    int texturesEvicted;
+    int frameCallbacks;
+    int frameCallbacksHeld;
+    int frameCallbacksTimed;
+    QHash<const void *, int> surfaceFrameCallbacks;
+    QHash<const void *, qint64> surfaceUploadBytes;
+};
+
+FrameStats &frameStats();
+void addUploadBytes(const void *surface, qint64 bytes);
+
+struct ShaderStats
+{
+    ShaderStats() : programs(0), cached(0), msecs(0) {}
+
+    int programs;
+    int cached;
+    int msecs;
+};
+
+ShaderStats &shaderStats();
 
 #endif
@@ -25,6 +25,7 @@
 #include "map.h"
 #include "camera.h"
 #include "common.h"
+#include "glstate.h"
 
 #include <QLineF>
 #include <QImage>
@@ -94,7 +95,7 @@ void Entity::timerEvent(QTimerEvent *)
 
 void Entity::render(const Map &map, const Camera &camera) const
 {
-    m_program->bind();
+    GLState::useProgram(m_program);
 
     m_program->setUniformValue(m_matrixUniform, camera.viewProjectionMatrix());
 
@@ -127,23 +128,19 @@ void Entity::render(const Map &map, const Camera &camera) const
     QVector<QVector3D> texBuffer;
     texBuffer << ta << tb << td << td << tb << tc;
 
-    m_program->enableAttributeArray(m_vertexAttr);
+    GLState::setAttributeArrays(m_vertexAttr, m_texAttr);
     m_program->setAttributeArray(m_vertexAttr, vertexBuffer.constData());
-    m_program->enableAttributeArray(m_texAttr);
     m_program->setAttributeArray(m_texAttr, texBuffer.constData());
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::enable(GL_BLEND);
+    GLState::blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    GLState::activeTexture(GL_TEXTURE0);
+    GLState::bindTexture(m_texture);
 
     glDrawArrays(GL_TRIANGLES, 0, 6);
 
-    glDisable(GL_BLEND);
-
-    m_program->disableAttributeArray(m_texAttr);
-    m_program->disableAttributeArray(m_vertexAttr);
+    GLState::disable(GL_BLEND);
 }
 
 void Entity::initialize()
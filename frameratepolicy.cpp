@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frameratepolicy.h"
+
+namespace {
+    // surfaces covering at least this much of the view count as large
+    const qreal largeFraction = 0.05;
+
+    const qreal smallArea = 64 * 64;
+    const qreal farDistance = 8;
+}
+
+FrameRatePolicy::Tier FrameRatePolicy::tier(const Surface &surface) const
+{
+    if (!surface.drawn)
+        return Heartbeat;
+
+    if (surface.focused || surface.screenFraction >= largeFraction)
+        return FullRate;
+
+    if (surface.docked || surface.screenArea < smallArea || surface.distance > farDistance)
+        return LowRate;
+
+    return ReducedRate;
+}
+
+int FrameRatePolicy::interval(Tier tier)
+{
+    switch (tier) {
+    case FullRate:
+        return 0;
+    case ReducedRate:
+        return 33;
+    case LowRate:
+        return 100;
+    default:
+        return 1000;
+    }
+}
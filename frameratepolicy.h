@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FRAMERATEPOLICY_H
+#define FRAMERATEPOLICY_H
+
+#include <qglobal.h>
+
+// Decides how often a client gets frame callbacks from how it was shown in
+// the last frame. Subclass and pass to View::setFrameRatePolicy() to change.
+class FrameRatePolicy
+{
+public:
+    enum Tier {
+        FullRate,
+        ReducedRate,
+        LowRate,
+        Heartbeat
+    };
+
+    struct Surface {
+        bool drawn;
+        bool focused;
+        bool docked;
+
+        // largest area covered on screen in any render pass, in pixels and as a fraction of the view
+        qreal screenArea;
+        qreal screenFraction;
+
+        // distance from the closest camera the surface was drawn from, in map units
+        qreal distance;
+    };
+
+    virtual ~FrameRatePolicy() {}
+
+    virtual Tier tier(const Surface &surface) const;
+
+    // minimum time between frame callbacks of a tier
+    static int interval(Tier tier);
+};
+
+#endif
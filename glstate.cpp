@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "glstate.h"
+
+#include "common.h"
+#include "vertexarray.h"
+
+#include <QOpenGLContext>
+
+namespace {
+    const GLenum trackedCaps[] =
+    {
+        GL_BLEND,
+        GL_CULL_FACE,
+        GL_DEPTH_TEST,
+        GL_STENCIL_TEST,
+        GL_SCISSOR_TEST
+    };
+
+    const int numTrackedCaps = sizeof(trackedCaps) / sizeof(trackedCaps[0]);
+    const int maxTextureUnits = 8;
+
+    enum { Unknown = -1 };
+
+    struct State
+    {
+        int caps[numTrackedCaps];
+
+        GLenum blendSrc;
+        GLenum blendDst;
+        int cullFace;
+        int frontFace;
+        int depthFunc;
+        int depthMask;
+        int colorMask;
+
+        QOpenGLShaderProgram *program;
+        bool programKnown;
+
+        int activeTexture;
+        qint64 textures[maxTextureUnits];
+
+        int vertexArray;
+
+        uint attributes;
+        bool attributesKnown;
+    };
+
+    State state;
+    bool initialized = false;
+    int numAttributes = 0;
+
+    void issued()
+    {
+        ++frameStats().glStateChanges;
+    }
+
+    bool skipped()
+    {
+        ++frameStats().glStateChangesSkipped;
+        return true;
+    }
+
+    bool unchanged(int &cached, int value)
+    {
+        if (cached == value)
+            return skipped();
+        cached = value;
+        issued();
+        return false;
+    }
+}
+
+void GLState::reset()
+{
+    for (int i = 0; i < numTrackedCaps; ++i)
+        state.caps[i] = Unknown;
+
+    state.blendSrc = 0;
+    state.blendDst = 0;
+    state.cullFace = Unknown;
+    state.frontFace = Unknown;
+    state.depthFunc = Unknown;
+    state.depthMask = Unknown;
+    state.colorMask = Unknown;
+
+    state.program = 0;
+    state.programKnown = false;
+
+    state.activeTexture = Unknown;
+    textureBindingChanged();
+
+    state.vertexArray = Unknown;
+
+    state.attributes = 0;
+    state.attributesKnown = false;
+
+    if (!initialized) {
+        GLint count = 0;
+        glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &count);
+        numAttributes = qMin(count, 32);
+    }
+
+    initialized = true;
+}
+
+void GLState::setEnabled(GLenum cap, bool enabled)
+{
+    if (!initialized)
+        reset();
+
+    int index = 0;
+    while (index < numTrackedCaps && trackedCaps[index] != cap)
+        ++index;
+
+    if (index < numTrackedCaps && unchanged(state.caps[index], enabled))
+        return;
+
+    if (enabled)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+
+void GLState::blendFunc(GLenum src, GLenum dst)
+{
+    if (!initialized)
+        reset();
+
+    if (state.blendSrc == src && state.blendDst == dst) {
+        skipped();
+        return;
+    }
+
+    state.blendSrc = src;
+    state.blendDst = dst;
+    issued();
+
+    glBlendFunc(src, dst);
+}
+
+void GLState::cullFace(GLenum mode)
+{
+    if (!initialized)
+        reset();
+
+    if (!unchanged(state.cullFace, mode))
+        glCullFace(mode);
+}
+
+void GLState::frontFace(GLenum mode)
+{
+    if (!initialized)
+        reset();
+
+    if (!unchanged(state.frontFace, mode))
+        glFrontFace(mode);
+}
+
+void GLState::depthFunc(GLenum func)
+{
+    if (!initialized)
+        reset();
+
+    if (!unchanged(state.depthFunc, func))
+        glDepthFunc(func);
+}
+
+void GLState::depthMask(bool enabled)
+{
+    if (!initialized)
+        reset();
+
+    if (!unchanged(state.depthMask, enabled))
+        glDepthMask(enabled);
+}
+
+void GLState::colorMask(bool enabled)
+{
+    if (!initialized)
+        reset();
+
+    if (!unchanged(state.colorMask, enabled))
+        glColorMask(enabled, enabled, enabled, enabled);
+}
+
+void GLState::useProgram(QOpenGLShaderProgram *program)
+{
+    if (!initialized)
+        reset();
+
+    if (state.programKnown && state.program == program) {
+        skipped();
+        return;
+    }
+
+    state.program = program;
+    state.programKnown = true;
+    issued();
+
+    program->bind();
+}
+
+void GLState::activeTexture(GLenum unit)
+{
+    if (!initialized)
+        reset();
+
+    if (!unchanged(state.activeTexture, unit - GL_TEXTURE0))
+        glActiveTexture(unit);
+}
+
+void GLState::bindTexture(GLuint texture)
+{
+    if (!initialized)
+        reset();
+
+    int unit = state.activeTexture;
+    if (unit < 0 || unit >= maxTextureUnits) {
+        issued();
+        glBindTexture(GL_TEXTURE_2D, texture);
+        return;
+    }
+
+    if (state.textures[unit] == texture) {
+        skipped();
+        return;
+    }
+
+    state.textures[unit] = texture;
+    issued();
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void GLState::textureBindingChanged()
+{
+    for (int i = 0; i < maxTextureUnits; ++i)
+        state.textures[i] = Unknown;
+}
+
+void GLState::bindVertexArray(GLuint id)
+{
+    if (!initialized)
+        reset();
+
+    if (!VertexArray::isSupported())
+        return;
+
+    if (!unchanged(state.vertexArray, id))
+        VertexArray::bindObject(id);
+}
+
+void GLState::setAttributeArrays(int a, int b, int c, int d)
+{
+    if (!initialized)
+        reset();
+
+    // the enabled arrays are tracked for the default vertex array object only
+    bindVertexArray(0);
+
+    uint mask = 0;
+    const int locations[] = { a, b, c, d };
+    for (int i = 0; i < 4; ++i) {
+        if (locations[i] >= 0 && locations[i] < numAttributes)
+            mask |= 1u << locations[i];
+    }
+
+    QOpenGLFunctions *functions = QOpenGLContext::currentContext()->functions();
+
+    uint changed = state.attributesKnown ? state.attributes ^ mask : ~0u;
+
+    for (int i = 0; i < numAttributes; ++i) {
+        if (!(changed & (1u << i)))
+            continue;
+
+        issued();
+        if (mask & (1u << i))
+            functions->glEnableVertexAttribArray(i);
+        else
+            functions->glDisableVertexAttribArray(i);
+    }
+
+    if (state.attributesKnown && !changed)
+        skipped();
+
+    state.attributes = mask;
+    state.attributesKnown = true;
+}
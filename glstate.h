@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <qopengl.h>
+
+class QOpenGLShaderProgram;
+
+// Shadows the GL state touched by the renderers so that redundant changes
+// never reach the driver. Everything is assumed unknown after reset().
+class GLState
+{
+public:
+    static void reset();
+
+    static void enable(GLenum cap) { setEnabled(cap, true); }
+    static void disable(GLenum cap) { setEnabled(cap, false); }
+    static void setEnabled(GLenum cap, bool enabled);
+
+    static void blendFunc(GLenum src, GLenum dst);
+    static void cullFace(GLenum mode);
+    static void frontFace(GLenum mode);
+    static void depthFunc(GLenum func);
+    static void depthMask(bool enabled);
+    static void colorMask(bool enabled);
+
+    static void useProgram(QOpenGLShaderProgram *program);
+
+    static void activeTexture(GLenum unit);
+    static void bindTexture(GLuint texture);
+    static void textureBindingChanged();
+
+    static void bindVertexArray(GLuint id);
+
+    // enables exactly the given vertex attribute arrays of the default vertex array object,
+    // negative locations are ignored
+    static void setAttributeArrays(int a, int b = -1, int c = -1, int d = -1);
+};
+
+#endif
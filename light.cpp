@@ -24,53 +24,56 @@
 
 #include "camera.h"
 #include "common.h"
+#include "glstate.h"
 #include "map.h"
+#include "vertexarray.h"
+
+#include <QOpenGLBuffer>
 
 uint Light::m_vertexAttr = 0;
-uint Light::m_normalAttr = 0;
 uint Light::m_matrixUniform = 0;
-uint Light::m_offsetUniform = 0;
 
 QOpenGLShaderProgram *Light::m_program = 0;
+UniformCache Light::m_uniforms;
+
+QOpenGLBuffer *Light::m_vertexData = 0;
+QOpenGLBuffer *Light::m_indexData = 0;
 
-QVector<QVector3D> Light::m_normalBuffer;
-QVector<QVector3D> Light::m_vertexBuffer;
-QVector<ushort> Light::m_indexBuffer;
+QVector<VertexArray *> Light::m_vertexArrays;
+QVector<QVector<Light::Batch> > Light::m_zoneBatches;
 
 const QVector3D lightSize(0.1, 0.04, 0.1);
 
-void Light::render(const Map &map, const Camera &camera) const
+void Light::render(int zone, const Camera &camera)
 {
-    glCullFace(GL_FRONT);
+    const QVector<Batch> &batches = m_zoneBatches.at(zone);
+    if (batches.isEmpty())
+        return;
 
-    m_program->bind();
+    GLState::cullFace(GL_FRONT);
 
-    m_program->setUniformValue(m_matrixUniform, camera.viewProjectionMatrix());
+    GLState::useProgram(m_program);
 
-    m_program->setUniformValue(m_offsetUniform, QVector4D(map.lights(m_zone).at(m_index) - QVector3D(lightSize.x(), 0.0, lightSize.z()) * 0.5, 0));
+    m_uniforms.setValue(m_matrixUniform, camera.viewProjectionMatrix());
 
-    m_program->enableAttributeArray(m_vertexAttr);
-    m_program->setAttributeArray(m_vertexAttr, m_vertexBuffer.constData());
-    m_program->enableAttributeArray(m_normalAttr);
-    m_program->setAttributeArray(m_normalAttr, m_normalBuffer.constData());
+    for (int i = 0; i < batches.size(); ++i) {
+        const Batch &batch = batches.at(i);
+        VertexArray *vertexArray = m_vertexArrays.at(batch.vertexArray);
 
-    glDrawElements(GL_TRIANGLES, m_indexBuffer.size(), GL_UNSIGNED_SHORT, m_indexBuffer.constData());
-
-    m_program->disableAttributeArray(m_normalAttr);
-    m_program->disableAttributeArray(m_vertexAttr);
+        vertexArray->bind();
+        glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, reinterpret_cast<GLvoid *>(batch.indexOffset * 2));
+        vertexArray->release();
+    }
 }
 
-void Light::initialize(QObject *parent)
+void Light::initialize(const Map &map, QObject *parent)
 {
     QByteArray vsrc =
         "attribute highp vec4 vertexAttr;\n"
-        "attribute highp vec3 normalAttr;\n"
-        "uniform highp vec4 offset;\n"
         "uniform mediump mat4 matrix;\n"
         "void main(void)\n"
         "{\n"
-        "    highp vec4 pos = vertexAttr + offset;\n"
-        "    gl_Position = matrix * pos;\n"
+        "    gl_Position = matrix * vertexAttr;\n"
         "}\n";
 
     QByteArray fsrc =
@@ -82,9 +85,9 @@ void Light::initialize(QObject *parent)
     m_program = generateShaderProgram(parent, vsrc, fsrc);
 
     m_vertexAttr = m_program->attributeLocation("vertexAttr");
-    m_normalAttr = m_program->attributeLocation("normalAttr");
     m_matrixUniform = m_program->uniformLocation("matrix");
-    m_offsetUniform = m_program->uniformLocation("offset");
+
+    m_uniforms.setProgram(m_program);
 
     Mesh mesh;
     for (int i = 0; i < 6; ++i)
@@ -93,8 +96,70 @@ void Light::initialize(QObject *parent)
     mesh.borderize(0.45);
     mesh.catmullClarkSubdivide();
 
-    m_normalBuffer = mesh.normalBuffer();
-    m_vertexBuffer = mesh.vertexBuffer();
-    for (int i = 0; i < mesh.indexBuffer().size(); ++i)
-        m_indexBuffer << mesh.indexBuffer().at(i);
+    const QVector<QVector3D> meshVertexBuffer = mesh.vertexBuffer();
+    const QVector<uint> meshIndexBuffer = mesh.indexBuffer();
+
+    // all fixtures of a zone are pre-transformed into one batch, which is split
+    // whenever its vertices no longer fit into 16 bit indices
+    QVector<QVector3D> vertexBuffer;
+    QVector<ushort> indexBuffer;
+    QVector<int> batchStarts;
+    batchStarts << 0;
+
+    m_zoneBatches.clear();
+    m_zoneBatches.resize(map.numZones());
+
+    for (int zone = 0; zone < map.numZones(); ++zone) {
+        Batch batch;
+        batch.vertexArray = batchStarts.size() - 1;
+        batch.indexOffset = indexBuffer.size();
+
+        const QVector<QVector3D> lights = map.lights(zone);
+        for (int i = 0; i < lights.size(); ++i) {
+            if (vertexBuffer.size() - batchStarts.last() + meshVertexBuffer.size() > 0x10000) {
+                batch.indexCount = indexBuffer.size() - batch.indexOffset;
+                if (batch.indexCount > 0)
+                    m_zoneBatches[zone] << batch;
+
+                batchStarts << vertexBuffer.size();
+                batch.vertexArray = batchStarts.size() - 1;
+                batch.indexOffset = indexBuffer.size();
+            }
+
+            QVector3D offset = lights.at(i) - QVector3D(lightSize.x(), 0.0, lightSize.z()) * 0.5;
+
+            int vertexOffset = vertexBuffer.size() - batchStarts.last();
+            for (int j = 0; j < meshVertexBuffer.size(); ++j)
+                vertexBuffer << meshVertexBuffer.at(j) + offset;
+
+            for (int j = 0; j < meshIndexBuffer.size(); ++j)
+                indexBuffer << vertexOffset + meshIndexBuffer.at(j);
+        }
+
+        batch.indexCount = indexBuffer.size() - batch.indexOffset;
+        if (batch.indexCount > 0)
+            m_zoneBatches[zone] << batch;
+    }
+
+    m_vertexData = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_vertexData->create();
+    m_vertexData->bind();
+    m_vertexData->allocate(vertexBuffer.constData(), vertexBuffer.size() * sizeof(QVector3D));
+    m_vertexData->release();
+
+    m_indexData = new QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+    m_indexData->create();
+    m_indexData->bind();
+    m_indexData->allocate(indexBuffer.constData(), indexBuffer.size() * sizeof(ushort));
+    m_indexData->release();
+
+    m_vertexArrays.clear();
+    for (int i = 0; i < batchStarts.size(); ++i) {
+        VertexArray *vertexArray = new VertexArray;
+        vertexArray->addAttribute(m_vertexAttr, 3, 0, batchStarts.at(i) * sizeof(QVector3D));
+        vertexArray->create(*m_vertexData, *m_indexData);
+        m_vertexArrays << vertexArray;
+    }
+
+    printf("Light vertex count: %d (%d batches)\n", vertexBuffer.size(), batchStarts.size());
 }
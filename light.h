@@ -24,42 +24,46 @@
 #define LIGHT_H
 
 #include <QVector>
-#include <QVector3D>
+
+#include "uniformcache.h"
 
 class Camera;
 class Map;
 
+class VertexArray;
+
+class QOpenGLBuffer;
 class QOpenGLShaderProgram;
 class QObject;
 
 class Light
 {
 public:
-    Light(int zone, int index)
-        : m_zone(zone)
-        , m_index(index)
-    {
-    }
-
-    void render(const Map &map, const Camera &camera) const;
+    static void render(int zone, const Camera &camera);
 
-    static void initialize(QObject *parent);
+    static void initialize(const Map &map, QObject *parent);
 
 private:
-    int m_zone;
-    int m_index;
-
     static uint m_vertexAttr;
-    static uint m_normalAttr;
     static uint m_matrixUniform;
-    static uint m_offsetUniform;
 
     static QOpenGLShaderProgram *m_program;
+    static UniformCache m_uniforms;
+
+    static QOpenGLBuffer *m_vertexData;
+    static QOpenGLBuffer *m_indexData;
+
+    // one vertex array per range of vertices addressable by 16 bit indices
+    static QVector<VertexArray *> m_vertexArrays;
 
-    static QVector<QVector3D> m_normalBuffer;
-    static QVector<QVector3D> m_vertexBuffer;
-    static QVector<ushort> m_indexBuffer;
+    struct Batch {
+        int vertexArray;
+        int indexOffset;
+        int indexCount;
+    };
 
+    // a zone's lights usually fit into a single batch
+    static QVector<QVector<Batch> > m_zoneBatches;
 };
 
 #endif
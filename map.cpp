@@ -24,12 +24,59 @@
 
 #include <qmath.h>
 #include <limits.h>
+#include <stdio.h>
 
+#include <QLineF>
 #include <QQueue>
 
 #include "common.h"
 
+static QMatrix4x4 outerProduct(const QVector3D &a, const QVector3D &b)
+{
+    return QMatrix4x4(a.x() * b.x(), a.x() * b.y(), a.x() * b.z(), 0,
+                      a.y() * b.x(), a.y() * b.y(), a.y() * b.z(), 0,
+                      a.z() * b.x(), a.z() * b.y(), a.z() * b.z(), 0,
+                      0, 0, 0, 0);
+}
+
+void Portal::updateTransforms()
+{
+    QVector3D up(0, 1, 0);
+    QVector3D right = this->right();
+
+    m_outlineTransform = QMatrix4x4(-m_scale * right.x(), 0, m_scale * m_normal.x(), m_pos.x(),
+                                    -m_scale * right.y(), m_scale, m_scale * m_normal.y(), 0,
+                                    -m_scale * right.z(), 0, m_scale * m_normal.z(), m_pos.z(),
+                                    0, 0, 0, 1);
+
+    if (!m_target)
+        return;
+
+    QVector3D targetRight = m_target->right();
+    QVector3D targetNormal = m_target->normal();
+
+    m_relativeScale = m_target->scale() / m_scale;
+
+    // right maps to -targetRight, up to up and normal to -targetNormal, scaled by the relative portal scale
+    QMatrix4x4 transform = (outerProduct(up, up)
+                            - outerProduct(targetRight, right)
+                            - outerProduct(targetNormal, m_normal)) * m_relativeScale;
+
+    QVector3D translation = m_target->pos() - transform.mapVector(m_pos);
+    transform.setColumn(3, QVector4D(translation, 1));
+
+    m_transform = transform;
+    m_inverseTransform = transform.inverted();
+
+    QLineF lineA(QPointF(), -QPointF(m_normal.x(), m_normal.z()));
+    QLineF lineB(QPointF(), QPointF(targetNormal.x(), targetNormal.z()));
+
+    m_yawDelta = lineA.angleTo(lineB);
+    m_targetPlane = QVector4D(targetNormal, -QVector3D::dotProduct(m_target->pos(), targetNormal));
+}
+
 Map::Map()
+    : m_maxPortalDepth(3)
 {
     QVector<QVector3D> lights;
 
@@ -96,6 +143,9 @@ Map::Map()
 
     m_portals << ca << cb;
 
+    for (int i = 0; i < m_portals.size(); ++i)
+        m_portals.at(i)->updateTransforms();
+
     m_dimX = 9;
     m_dimY = 21;
 
@@ -231,3 +281,198 @@ QVector<QVector3D> Map::lights(int z) const
     return m_lights.at(z);
 }
 
+static inline qreal dot(const QPointF &a, const QPointF &b)
+{
+    return a.x() * b.x() + a.y() * b.y();
+}
+
+static inline QPointF toMap(const QVector3D &v)
+{
+    return QPointF(v.x(), v.z());
+}
+
+class Map::HalfPlane
+{
+public:
+    HalfPlane() {}
+    HalfPlane(const QPointF &origin, const QPointF &normal)
+        : m_origin(origin)
+        , m_normal(normal)
+    {
+    }
+
+    qreal distance(const QPointF &p) const
+    {
+        return dot(p - m_origin, m_normal);
+    }
+
+    HalfPlane mapped(const QMatrix4x4 &transform) const
+    {
+        QVector3D origin = transform.map(QVector3D(m_origin.x(), 0, m_origin.y()));
+        QVector3D normal = transform.mapVector(QVector3D(m_normal.x(), 0, m_normal.y()));
+        return HalfPlane(QPointF(origin.x(), origin.z()), QPointF(normal.x(), normal.z()));
+    }
+
+private:
+    QPointF m_origin;
+    QPointF m_normal;
+};
+
+static QVector<QPointF> mapped(const QVector<QPointF> &points, const QMatrix4x4 &transform)
+{
+    QVector<QPointF> result;
+    for (int i = 0; i < points.size(); ++i)
+        result << toMap(transform.map(QVector3D(points.at(i).x(), 0, points.at(i).y())));
+    return result;
+}
+
+// signed side of p relative to the line from a through b
+static inline qreal side(const QPointF &a, const QPointF &b, const QPointF &p)
+{
+    return (b.x() - a.x()) * (p.y() - a.y()) - (b.y() - a.y()) * (p.x() - a.x());
+}
+
+// Bounds the lines from source through the aperture edge at a, the other edge being at b,
+// by the line through a and a source vertex that separates the source from the aperture.
+static bool separatingPlane(const QVector<QPointF> &source, const QPointF &a, const QPointF &b, QPointF *normal)
+{
+    for (int i = 0; i < source.size(); ++i) {
+        const QPointF &s = source.at(i);
+        qreal reference = side(s, a, b);
+        if (qFuzzyIsNull(reference))
+            continue;
+
+        bool separating = true;
+        for (int j = 0; j < source.size() && separating; ++j)
+            separating = side(s, a, source.at(j)) * reference <= 0;
+
+        if (separating) {
+            QPointF delta = a - s;
+            *normal = reference > 0 ? QPointF(-delta.y(), delta.x()) : QPointF(delta.y(), -delta.x());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Map::generateVisibility(const QRectF &portalRect)
+{
+    QTime time;
+    time.start();
+
+    m_visibleChains.clear();
+
+    // chains would alias, so leave every portal potentially visible
+    if (m_portals.size() > maxChainPortals || m_maxPortalDepth > maxChainDepth) {
+        printf("Potentially visible portal chains: disabled (%d portals, depth %d)\n",
+               m_portals.size(), m_maxPortalDepth);
+        return;
+    }
+
+    m_visibleChains.resize(m_dimX * m_dimY);
+
+    int total = 0;
+    for (int y = 0; y < m_dimY; ++y) {
+        for (int x = 0; x < m_dimX; ++x) {
+            if (!empty(x, y))
+                continue;
+
+            QVector<QPointF> cell;
+            cell << QPointF(x, y) << QPointF(x + 1, y) << QPointF(x + 1, y + 1) << QPointF(x, y + 1);
+
+            QSet<quint64> &chains = m_visibleChains[y * m_dimX + x];
+            generateVisibility(chains, 0, zone(x, y), 0, cell, cell, QVector<HalfPlane>(), portalRect);
+            total += chains.size();
+        }
+    }
+
+    printf("Potentially visible portal chains: %d (%d ms)\n", total, time.elapsed());
+}
+
+void Map::generateVisibility(QSet<quint64> &chains, quint64 chain, int zone, int depth,
+                             const QVector<QPointF> &viewer, const QVector<QPointF> &source,
+                             const QVector<HalfPlane> &region, const QRectF &portalRect) const
+{
+    if (depth >= m_maxPortalDepth)
+        return;
+
+    for (int i = 0; i < m_portals.size(); ++i) {
+        const Portal *portal = m_portals.at(i);
+        if (!portal->target() || this->zone(portal->pos()) != zone)
+            continue;
+
+        QPointF pos = toMap(portal->pos());
+        QPointF normal = toMap(portal->normal());
+
+        // the camera has to be in front of the portal for it to be rendered
+        bool inFront = false;
+        for (int j = 0; j < viewer.size() && !inFront; ++j)
+            inFront = dot(viewer.at(j) - pos, normal) > 0;
+        if (!inFront)
+            continue;
+
+        QPointF a = toMap(portal->outlineTransform().map(QVector3D(portalRect.left(), 0, 0)));
+        QPointF b = toMap(portal->outlineTransform().map(QVector3D(portalRect.right(), 0, 0)));
+
+        // clip the aperture against the region visible through the previous portals
+        qreal t0 = 0;
+        qreal t1 = 1;
+        for (int j = 0; j < region.size() && t0 <= t1; ++j) {
+            qreal da = region.at(j).distance(a);
+            qreal db = region.at(j).distance(b);
+            if (da < 0 && db < 0)
+                t1 = -1;
+            else if (da < 0)
+                t0 = qMax(t0, da / (da - db));
+            else if (db < 0)
+                t1 = qMin(t1, da / (da - db));
+        }
+
+        if (t0 > t1)
+            continue;
+
+        QPointF clippedA = a + t0 * (b - a);
+        QPointF clippedB = a + t1 * (b - a);
+
+        quint64 next = portalChain(chain, i);
+        chains << next;
+
+        if (depth + 1 >= m_maxPortalDepth)
+            continue;
+
+        // narrow the region to what can be seen from the source through the clipped aperture
+        QVector<HalfPlane> narrowed;
+        narrowed << HalfPlane(pos, -normal);
+
+        QPointF separatingNormal;
+        if (separatingPlane(source, clippedA, clippedB, &separatingNormal))
+            narrowed << HalfPlane(clippedA, separatingNormal);
+        if (separatingPlane(source, clippedB, clippedA, &separatingNormal))
+            narrowed << HalfPlane(clippedB, separatingNormal);
+
+        const QMatrix4x4 &transform = portal->transform();
+
+        QVector<HalfPlane> targetRegion;
+        for (int j = 0; j < narrowed.size(); ++j)
+            targetRegion << narrowed.at(j).mapped(transform);
+
+        QVector<QPointF> aperture;
+        aperture << clippedA << clippedB;
+
+        generateVisibility(chains, next, this->zone(portal->target()->pos()), depth + 1,
+                           mapped(viewer, transform), mapped(aperture, transform), targetRegion, portalRect);
+    }
+}
+
+bool Map::potentiallyVisible(const QVector3D &pos, quint64 chain) const
+{
+    int x = qFloor(pos.x());
+    int y = qFloor(pos.z());
+
+    // be conservative about cells that weren't part of the visibility pass
+    if (!contains(x, y) || m_visibleChains.isEmpty())
+        return true;
+
+    return m_visibleChains.at(y * m_dimX + x).contains(chain);
+}
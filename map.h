@@ -24,9 +24,13 @@
 #define MAP_H
 
 #include <QByteArray>
+#include <QMatrix4x4>
+#include <QRectF>
+#include <QSet>
 #include <QTime>
 #include <QVector>
 #include <QVector3D>
+#include <QVector4D>
 
 #include <qmath.h>
 
@@ -45,9 +49,13 @@ public:
         , m_type(type)
         , m_scale(scale)
         , m_target(0)
+        , m_relativeScale(1)
+        , m_yawDelta(0)
     {
     }
 
+    void updateTransforms();
+
     void setType(Type type) { m_type = type; }
     void setScale(qreal scale) { m_scale = scale; }
 
@@ -59,12 +67,33 @@ public:
     Type type() const { return m_type; }
     qreal scale() const { return m_scale; }
 
+    QVector3D right() const { return QVector3D::crossProduct(QVector3D(0, 1, 0), m_normal); }
+
+    // maps portal outline coordinates to world coordinates
+    const QMatrix4x4 &outlineTransform() const { return m_outlineTransform; }
+
+    // maps world coordinates in front of this portal to the target portal's side
+    const QMatrix4x4 &transform() const { return m_transform; }
+    const QMatrix4x4 &inverseTransform() const { return m_inverseTransform; }
+
+    qreal relativeScale() const { return m_relativeScale; }
+    qreal yawDelta() const { return m_yawDelta; }
+
+    QVector4D targetPlane() const { return m_targetPlane; }
+
 private:
     QVector3D m_pos;
     QVector3D m_normal;
     Type m_type;
     qreal m_scale;
     Portal *m_target;
+
+    QMatrix4x4 m_outlineTransform;
+    QMatrix4x4 m_transform;
+    QMatrix4x4 m_inverseTransform;
+    qreal m_relativeScale;
+    qreal m_yawDelta;
+    QVector4D m_targetPlane;
 };
 
 class Map
@@ -156,7 +185,33 @@ public:
         return m_portals.at(i);
     }
 
+    int maxPortalDepth() const
+    {
+        return m_maxPortalDepth;
+    }
+
+    // identifies a chain of portals by packing the portal indices, chains are only
+    // unique for up to maxChainPortals portals and maxChainDepth portals deep
+    enum {
+        maxChainPortals = 255,
+        maxChainDepth = 8
+    };
+
+    static quint64 portalChain(quint64 prefix, int portal)
+    {
+        return (prefix << 8) | quint64(portal + 1);
+    }
+
+    void generateVisibility(const QRectF &portalRect);
+    bool potentiallyVisible(const QVector3D &pos, quint64 chain) const;
+
 private:
+    class HalfPlane;
+
+    void generateVisibility(QSet<quint64> &chains, quint64 chain, int zone, int depth,
+                            const QVector<QPointF> &viewer, const QVector<QPointF> &source,
+                            const QVector<HalfPlane> &region, const QRectF &portalRect) const;
+
     QByteArray m_map;
     QVector<int> m_zones;
     QVector<bool> m_occupied;
@@ -169,8 +224,10 @@ private:
     QVector<QVector<QVector3D> > m_lights;
     QVector<QList<QVector<QVector3D > > > m_tiles;
     QVector<Portal *> m_portals;
+    QVector<QSet<quint64> > m_visibleChains;
 
     int m_maxLights;
+    int m_maxPortalDepth;
 };
 
 #endif
@@ -13,5 +13,5 @@ CONFIG += use_pkgconfig
 QT += gui compositor
 
 # Input
-SOURCES += main.cpp view.cpp mesh.cpp camera.cpp entity.cpp surfaceitem.cpp map.cpp light.cpp common.cpp
-HEADERS += view.h point.h mesh.h camera.h entity.h surfaceitem.h map.h light.h
+SOURCES += main.cpp view.cpp mesh.cpp camera.cpp entity.cpp surfaceitem.cpp map.cpp light.cpp common.cpp portalmesh.cpp spritebatch.cpp glstate.cpp vertexarray.cpp uniformcache.cpp textureuploader.cpp mipmapchain.cpp uploadscheduler.cpp texturepool.cpp texturebudget.cpp frameratepolicy.cpp
+HEADERS += view.h point.h mesh.h camera.h entity.h surfaceitem.h map.h light.h portalmesh.h spritebatch.h glstate.h vertexarray.h uniformcache.h textureuploader.h mipmapchain.h uploadscheduler.h texturepool.h texturebudget.h frameratepolicy.h
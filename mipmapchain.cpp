@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mipmapchain.h"
+
+#include "common.h"
+
+namespace {
+    inline uint average(uint a, uint b, uint c, uint d)
+    {
+        // two channels at a time, each sum fits in the eight spare bits above it
+        uint rb = (a & 0x00ff00ff) + (b & 0x00ff00ff) + (c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002;
+        uint ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) + ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff) + 0x00020002;
+        return ((rb >> 2) & 0x00ff00ff) | (((ag >> 2) & 0x00ff00ff) << 8);
+    }
+
+    void downsample(const QImage &src, QImage &dst, const QRect &rect)
+    {
+        const int maxX = src.width() - 1;
+        const int maxY = src.height() - 1;
+
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            const uint *a = reinterpret_cast<const uint *>(src.constScanLine(qMin(2 * y, maxY)));
+            const uint *b = reinterpret_cast<const uint *>(src.constScanLine(qMin(2 * y + 1, maxY)));
+            uint *out = reinterpret_cast<uint *>(dst.scanLine(y));
+
+            for (int x = rect.left(); x <= rect.right(); ++x) {
+                int x0 = qMin(2 * x, maxX);
+                int x1 = qMin(2 * x + 1, maxX);
+                out[x] = average(a[x0], a[x1], b[x0], b[x1]);
+            }
+        }
+    }
+
+    QRect parentRect(const QRect &rect, const QSize &size)
+    {
+        return QRect(QPoint(rect.left() / 2, rect.top() / 2), QPoint(rect.right() / 2, rect.bottom() / 2))
+            & QRect(QPoint(), size);
+    }
+}
+
+void MipmapChain::reset(const QImage &image)
+{
+    m_levels.clear();
+
+    QImage level = hasUploadLayout(image) ? image : image.convertToFormat(QImage::Format_ARGB32);
+    while (level.width() > 1 || level.height() > 1) {
+        QImage next(qMax(1, level.width() / 2), qMax(1, level.height() / 2), level.format());
+        downsample(level, next, next.rect());
+        m_levels << next;
+        level = next;
+    }
+}
+
+void MipmapChain::clear()
+{
+    m_levels.clear();
+}
+
+QVector<MipmapChain::Region> MipmapChain::update(const QImage &image, const QVector<QRect> &rects)
+{
+    if (!hasUploadLayout(image))
+        return update(image.convertToFormat(QImage::Format_ARGB32), rects);
+
+    QVector<Region> regions;
+
+    if (m_levels.isEmpty()) {
+        reset(image);
+        for (int level = 0; level < m_levels.size(); ++level) {
+            Region region = { level + 1, m_levels.at(level).rect() };
+            regions << region;
+        }
+        return regions;
+    }
+
+    for (int i = 0; i < rects.size(); ++i) {
+        QRect rect = rects.at(i);
+        const QImage *source = &image;
+
+        for (int level = 0; level < m_levels.size(); ++level) {
+            QImage &target = m_levels[level];
+            rect = parentRect(rect, target.size());
+            if (rect.isEmpty())
+                break;
+
+            downsample(*source, target, rect);
+
+            Region region = { level + 1, rect };
+            regions << region;
+
+            source = &target;
+        }
+    }
+
+    return regions;
+}
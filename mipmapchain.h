@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MIPMAPCHAIN_H
+#define MIPMAPCHAIN_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+// CPU copy of the mip levels below level 0, so that damage only needs to be
+// filtered and uploaded over the affected region of each level
+class MipmapChain
+{
+public:
+    struct Region {
+        int level;
+        QRect rect;
+    };
+
+    void reset(const QImage &image);
+    void clear();
+
+    // filters the damaged rects of level 0 into the CPU levels and returns the regions
+    // that changed, an empty chain is rebuilt and returned whole
+    QVector<Region> update(const QImage &image, const QVector<QRect> &rects);
+
+    // level 0 is the image the chain was built from and is not kept
+    const QImage &level(int level) const { return m_levels.at(level - 1); }
+
+private:
+    QVector<QImage> m_levels;
+};
+
+#endif
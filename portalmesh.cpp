@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "portalmesh.h"
+
+#include "camera.h"
+#include "common.h"
+#include "glstate.h"
+
+#include <QMatrix>
+#include <QPainterPath>
+#include <QVector2D>
+
+// flattening scales of the detail levels, from finest to coarsest
+static const qreal levelScales[] = { 300, 75, 20 };
+
+PortalMesh::PortalMesh()
+    : m_vertexAttr(0)
+    , m_matrixUniform(0)
+    , m_program(0)
+{
+}
+
+void PortalMesh::initialize(const QPainterPath &path, QObject *parent)
+{
+    QByteArray vsrc =
+        "attribute highp vec4 vertexAttr;\n"
+        "uniform mediump mat4 matrix;\n"
+        "void main(void)\n"
+        "{\n"
+        "    gl_Position = matrix * vertexAttr;\n"
+        "}\n";
+
+    QByteArray fsrc =
+        "void main(void)\n"
+        "{\n"
+        "    gl_FragColor = vec4(0.0);\n"
+        "}\n";
+
+    m_program = generateShaderProgram(parent, vsrc, fsrc);
+
+    m_vertexAttr = m_program->attributeLocation("vertexAttr");
+    m_matrixUniform = m_program->uniformLocation("matrix");
+
+    m_uniforms.setProgram(m_program);
+
+    QVector<QVector2D> vertices;
+    for (uint i = 0; i < sizeof(levelScales) / sizeof(levelScales[0]); ++i) {
+        QMatrix matrix;
+        matrix.scale(levelScales[i], levelScales[i]);
+        QPolygonF polygon = matrix.inverted().map(path.toFillPolygon(matrix));
+
+        if (i == 0)
+            m_outline = polygon;
+
+        m_levels << qMakePair(vertices.size(), polygon.size());
+        m_levelScales << levelScales[i];
+
+        for (int j = 0; j < polygon.size(); ++j)
+            vertices << QVector2D(polygon.at(j));
+    }
+
+    m_vertexData = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_vertexData.create();
+    m_vertexData.bind();
+    m_vertexData.allocate(vertices.constData(), vertices.size() * sizeof(QVector2D));
+    m_vertexData.release();
+
+    m_vertexArray.addAttribute(m_vertexAttr, 2);
+    m_vertexArray.create(m_vertexData);
+
+    printf("Portal outline vertex counts:");
+    for (int i = 0; i < m_levels.size(); ++i)
+        printf(" %d", m_levels.at(i).second);
+    printf("\n");
+}
+
+int PortalMesh::levelForSize(qreal size) const
+{
+    QRectF bounds = boundingRect();
+    qreal scale = size / qMax(bounds.width(), bounds.height());
+
+    for (int i = m_levels.size() - 1; i > 0; --i) {
+        if (m_levelScales.at(i) >= scale)
+            return i;
+    }
+
+    return 0;
+}
+
+void PortalMesh::render(const Camera &camera, const QMatrix4x4 &transform, int level)
+{
+    GLState::useProgram(m_program);
+    m_uniforms.setValue(m_matrixUniform, camera.viewProjectionMatrix() * transform);
+
+    m_vertexArray.bind();
+    glDrawArrays(GL_TRIANGLE_FAN, m_levels.at(level).first, m_levels.at(level).second);
+    m_vertexArray.release();
+}
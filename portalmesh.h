@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PORTALMESH_H
+#define PORTALMESH_H
+
+#include <QOpenGLBuffer>
+#include <QPair>
+#include <QPolygonF>
+#include <QVector>
+
+#include "uniformcache.h"
+#include "vertexarray.h"
+
+class Camera;
+
+class QMatrix4x4;
+class QObject;
+class QOpenGLShaderProgram;
+class QPainterPath;
+
+class PortalMesh
+{
+public:
+    PortalMesh();
+
+    void initialize(const QPainterPath &path, QObject *parent);
+
+    QPolygonF outline() const { return m_outline; }
+    QRectF boundingRect() const { return m_outline.boundingRect(); }
+
+    int levelCount() const { return m_levels.size(); }
+    int levelForSize(qreal size) const;
+
+    void render(const Camera &camera, const QMatrix4x4 &transform, int level);
+
+private:
+    uint m_vertexAttr;
+    uint m_matrixUniform;
+
+    QOpenGLShaderProgram *m_program;
+    UniformCache m_uniforms;
+    QOpenGLBuffer m_vertexData;
+    VertexArray m_vertexArray;
+
+    QPolygonF m_outline;
+    QVector<qreal> m_levelScales;
+    QVector<QPair<int, int> > m_levels;
+};
+
+#endif
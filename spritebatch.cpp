@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spritebatch.h"
+
+#include "common.h"
+#include "glstate.h"
+
+#include <QtAlgorithms>
+
+#include <string.h>
+
+// x, y, s, t, alpha
+static const int vertexSize = 5;
+
+SpriteBatch::SpriteBatch()
+    : m_vertexAttr(0)
+    , m_texCoordAttr(0)
+    , m_alphaAttr(0)
+    , m_program(0)
+{
+}
+
+void SpriteBatch::initialize(QObject *parent)
+{
+    QByteArray vsrc =
+        "attribute highp vec4 vertexAttr;\n"
+        "attribute highp vec2 texCoordAttr;\n"
+        "attribute lowp float alphaAttr;\n"
+        "varying highp vec2 texCoord;\n"
+        "varying lowp float alpha;\n"
+        "void main(void)\n"
+        "{\n"
+        "    texCoord = texCoordAttr;\n"
+        "    alpha = alphaAttr;\n"
+        "    gl_Position = vertexAttr;\n"
+        "}\n";
+
+    QByteArray fsrc =
+        "uniform sampler2D texture;\n"
+        "varying highp vec2 texCoord;\n"
+        "varying lowp float alpha;\n"
+        "void main(void)\n"
+        "{\n"
+        "    gl_FragColor = texture2D(texture, texCoord) * alpha;\n"
+        "}\n";
+
+    m_program = generateShaderProgram(parent, vsrc, fsrc);
+
+    m_vertexAttr = m_program->attributeLocation("vertexAttr");
+    m_texCoordAttr = m_program->attributeLocation("texCoordAttr");
+    m_alphaAttr = m_program->attributeLocation("alphaAttr");
+
+    m_vertexData = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_vertexData.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    m_vertexData.create();
+
+    int stride = vertexSize * sizeof(float);
+    m_vertexArray.addAttribute(m_vertexAttr, 2, stride, 0);
+    m_vertexArray.addAttribute(m_texCoordAttr, 2, stride, 2 * sizeof(float));
+    m_vertexArray.addAttribute(m_alphaAttr, 1, stride, 4 * sizeof(float));
+    m_vertexArray.create(m_vertexData);
+}
+
+bool SpriteBatch::textureLessThan(const Sprite &a, const Sprite &b)
+{
+    return a.texture < b.texture;
+}
+
+void SpriteBatch::add(const QRectF &target, GLuint texture, qreal alpha, const QRectF &source)
+{
+    Sprite sprite;
+    sprite.target = target;
+    sprite.source = source.isNull() ? QRectF(0, 0, 1, 1) : source;
+    sprite.texture = texture;
+    sprite.alpha = alpha;
+
+    m_sprites << sprite;
+}
+
+void SpriteBatch::render(const QSizeF &viewport)
+{
+    if (m_sprites.isEmpty())
+        return;
+
+    // sprites sharing a texture end up next to each other, but only within runs of
+    // sprites that don't overlap, so that blending still follows queue order
+    int runStart = 0;
+    for (int i = 1; i <= m_sprites.size(); ++i) {
+        bool overlaps = false;
+        for (int j = runStart; j < i && i < m_sprites.size() && !overlaps; ++j)
+            overlaps = m_sprites.at(j).target.intersects(m_sprites.at(i).target);
+
+        if (i == m_sprites.size() || overlaps) {
+            qStableSort(m_sprites.begin() + runStart, m_sprites.begin() + i, textureLessThan);
+            runStart = i;
+        }
+    }
+
+    m_vertices.resize(m_sprites.size() * 6 * vertexSize);
+    float *v = m_vertices.data();
+
+    for (int i = 0; i < m_sprites.size(); ++i) {
+        const Sprite &sprite = m_sprites.at(i);
+        const QRectF &target = sprite.target;
+        const QRectF &s = sprite.source;
+
+        float xmin = -1 + 2 * (target.left() / viewport.width());
+        float xmax = -1 + 2 * (target.right() / viewport.width());
+        float ymin = -1 + 2 * (viewport.height() - target.top()) / viewport.height();
+        float ymax = -1 + 2 * (viewport.height() - target.bottom()) / viewport.height();
+
+        const float quad[] =
+        {
+            xmin, ymin, float(s.left()), float(s.top()), sprite.alpha,
+            xmax, ymin, float(s.right()), float(s.top()), sprite.alpha,
+            xmin, ymax, float(s.left()), float(s.bottom()), sprite.alpha,
+            xmin, ymax, float(s.left()), float(s.bottom()), sprite.alpha,
+            xmax, ymin, float(s.right()), float(s.top()), sprite.alpha,
+            xmax, ymax, float(s.right()), float(s.bottom()), sprite.alpha
+        };
+
+        memcpy(v, quad, sizeof(quad));
+        v += 6 * vertexSize;
+    }
+
+    GLState::useProgram(m_program);
+
+    m_vertexData.bind();
+    // reallocating orphans the storage still in use by the previous frame
+    m_vertexData.allocate(m_vertices.constData(), m_vertices.size() * sizeof(float));
+    m_vertexData.release();
+
+    m_vertexArray.bind();
+
+    GLState::activeTexture(GL_TEXTURE0);
+
+    int start = 0;
+    while (start < m_sprites.size()) {
+        GLuint texture = m_sprites.at(start).texture;
+
+        int end = start + 1;
+        while (end < m_sprites.size() && m_sprites.at(end).texture == texture)
+            ++end;
+
+        GLState::bindTexture(texture);
+        glDrawArrays(GL_TRIANGLES, start * 6, (end - start) * 6);
+
+        start = end;
+    }
+
+    m_vertexArray.release();
+
+    m_sprites.clear();
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include <QOpenGLBuffer>
+#include <QRectF>
+#include <QVector>
+
+#include "vertexarray.h"
+
+#include <qopengl.h>
+
+class QObject;
+class QOpenGLShaderProgram;
+
+class SpriteBatch
+{
+public:
+    SpriteBatch();
+
+    void initialize(QObject *parent);
+
+    void add(const QRectF &target, GLuint texture, qreal alpha = 1.0, const QRectF &source = QRectF());
+    void render(const QSizeF &viewport);
+
+private:
+    struct Sprite {
+        QRectF target;
+        QRectF source;
+        GLuint texture;
+        float alpha;
+    };
+
+    static bool textureLessThan(const Sprite &a, const Sprite &b);
+
+    uint m_vertexAttr;
+    uint m_texCoordAttr;
+    uint m_alphaAttr;
+
+    QOpenGLShaderProgram *m_program;
+    QOpenGLBuffer m_vertexData;
+    VertexArray m_vertexArray;
+
+    QVector<Sprite> m_sprites;
+    QVector<float> m_vertices;
+};
+
+#endif
@@ -24,39 +24,115 @@
 
 #include "camera.h"
 #include "common.h"
+#include "glstate.h"
 #include "map.h"
+#include "texturepool.h"
+#include "textureuploader.h"
+#include "vertexarray.h"
 #include "waylandsurface.h"
 
 #include <QGuiApplication>
 #include <QPainter>
+#include <QOpenGLBuffer>
 #include <QOpenGLPaintDevice>
 #include <QScreen>
 
-QOpenGLShaderProgram *SurfaceItem::m_program = 0;
+#include <float.h>
+#include <limits.h>
 
-uint SurfaceItem::m_vertexAttr = 0;
-uint SurfaceItem::m_texCoordAttr = 0;
-uint SurfaceItem::m_matrixUniform = 0;
-uint SurfaceItem::m_pixelSizeUniform = 0;
-uint SurfaceItem::m_eyeUniform = 0;
-uint SurfaceItem::m_focusColorUniform = 0;
-uint SurfaceItem::m_normalUniform = 0;
-uint SurfaceItem::m_lightsUniform = 0;
-uint SurfaceItem::m_numLightsUniform = 0;
+QHash<int, SurfaceItem::Program *> SurfaceItem::m_programs;
+
+QOpenGLBuffer *SurfaceItem::m_quadData = 0;
+VertexArray *SurfaceItem::m_quadArray = 0;
+
+uint SurfaceItem::m_cornerAttr = 0;
+
+GLuint SurfaceItem::m_placeholderTexture = 0;
+
+namespace {
+    // damage of a hidden surface is uploaded once it adds up to this many full surfaces
+    const int backlogSurfaces = 4;
+
+    // uploads beyond this count cost more in call overhead than the extra pixels of a merge
+    const int maxDamageRects = 8;
+
+    // approximate cost of a separate sub-image upload, in pixels
+    const int uploadOverhead = 64 * 64;
+
+    int area(const QRect &rect)
+    {
+        return rect.width() * rect.height();
+    }
+
+    int mergeCost(const QRect &a, const QRect &b)
+    {
+        return area(a | b) - area(a) - area(b);
+    }
+
+    void addDamage(QVector<QRect> &rects, QRect rect)
+    {
+        if (rect.isEmpty())
+            return;
+
+        // keep merging while the bounding rect is cheaper than uploading separately
+        for (int i = 0; i < rects.size(); ++i) {
+            const QRect &other = rects.at(i);
+            if (other.contains(rect))
+                return;
+            if (rect.contains(other) || rect.intersects(other) || mergeCost(rect, other) < uploadOverhead) {
+                rect |= other;
+                rects.remove(i);
+                i = -1;
+            }
+        }
+
+        rects << rect;
+
+        while (rects.size() > maxDamageRects) {
+            int bestA = 0;
+            int bestB = 1;
+            int bestCost = INT_MAX;
+            for (int a = 0; a < rects.size(); ++a) {
+                for (int b = a + 1; b < rects.size(); ++b) {
+                    int cost = mergeCost(rects.at(a), rects.at(b));
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestA = a;
+                        bestB = b;
+                    }
+                }
+            }
+
+            QRect merged = rects.at(bestA) | rects.at(bestB);
+            rects.remove(bestB);
+            rects.remove(bestA);
+            addDamage(rects, merged);
+        }
+    }
+}
 
 SurfaceItem::SurfaceItem(WaylandSurface *surface)
     : m_surface(surface)
     , m_depthOffset(0)
     , m_opacity(0.55)
     , m_textureId(0)
+    , m_backlogBytes(0)
+    , m_screenArea(0)
+    , m_distance(FLT_MAX)
+    , m_used(false)
+    , m_frameCallbackInterval(0)
+    , m_evicted(false)
+    , m_restoring(false)
     , m_height(maxHeight() * 0.99)
+    , m_verticesValid(false)
     , m_focus(false)
     , m_mipmap(true)
+    , m_mipmapsStale(false)
 {
     m_time.start();
     connect(surface, SIGNAL(damaged(const QRect &)), this, SLOT(surfaceDamaged(const QRect &)));
     connect(surface, SIGNAL(sizeChanged()), this, SLOT(sizeChanged()));
-    m_dirty = QRect(QPoint(), surface->size());
+    m_dirty << QRect(QPoint(), surface->size());
 
     qDebug() << "surface size:" << surface->size();
     m_opacityAnimation = new QPropertyAnimation(this, "opacity");
@@ -66,8 +142,12 @@ SurfaceItem::SurfaceItem(WaylandSurface *surface)
 
 SurfaceItem::~SurfaceItem()
 {
-    if (!m_textureSize.isNull())
-        glDeleteTextures(1, &m_textureId);
+    if (m_textureId) {
+        TexturePool::Texture texture;
+        texture.id = m_textureId;
+        texture.size = m_storageSize;
+        TexturePool::release(texture);
+    }
 }
 
 void SurfaceItem::setOpacity(qreal op)
@@ -90,76 +170,143 @@ void SurfaceItem::setFocus(bool focus)
 void SurfaceItem::initialize(const Map &map, QObject *parent)
 {
     QByteArray vsrc =
-        "attribute highp vec4 vertexAttr;\n"
-        "attribute highp vec2 texCoordAttr;\n"
+        "attribute highp vec2 cornerAttr;\n"
         "uniform mediump mat4 matrix;\n"
+        "uniform highp vec3 center;\n"
+        "uniform highp vec3 right;\n"
+        "uniform highp vec3 up;\n"
+        "uniform lowp float yInverted;\n"
         "varying highp vec2 texCoord;\n"
         "varying mediump vec3 p;\n"
         "void main(void)\n"
         "{\n"
-        "    texCoord = texCoordAttr;\n"
-        "    p = vertexAttr.xyz;\n"
-        "    gl_Position = matrix * vertexAttr;\n"
+        "    texCoord = vec2(cornerAttr.x, mix(cornerAttr.y, 1.0 - cornerAttr.y, yInverted));\n"
+        "    p = center + right * (cornerAttr.x - 0.5) + up * (cornerAttr.y - 0.5);\n"
+        "    gl_Position = matrix * vec4(p, 1.0);\n"
         "}\n";
 
     QByteArray fsrc =
         useSimpleShading() ?
             "uniform sampler2D texture;\n"
+            "uniform highp vec2 textureScale;\n"
             "varying highp vec2 texCoord;\n"
             "uniform lowp float focusColor;\n"
             "void main(void)\n"
             "{\n"
-            "    lowp vec4 tex = texture2D(texture, texCoord);\n"
+            "    lowp vec4 tex = texture2D(texture, texCoord * textureScale);\n"
             "    gl_FragColor = tex * 0.9 * focusColor * tex.a;\n"
             "}\n"
         :
             "uniform sampler2D texture;\n"
+            "uniform highp vec2 textureScale;\n"
             "uniform highp vec2 pixelSize;\n"
             "uniform lowp vec3 normal;\n"
             "varying highp vec2 texCoord;\n"
             "varying highp vec3 p;\n"
-            "uniform int numLights;\n"
-            "uniform highp vec3 lights[NUM_LIGHTS];\n"
+            "LIGHTS_DECLARATION"
             "uniform highp vec3 eye;\n"
             "uniform lowp float focusColor;\n"
             "void main(void)\n"
             "{\n"
-            "    highp vec4 tex = texture2D(texture, texCoord);\n"
+            "    highp vec4 tex = texture2D(texture, texCoord * textureScale);\n"
             "    highp vec2 dt = abs(texCoord - vec2(0.5));\n"
             "    highp vec3 toEyeN = normalize(eye - p);\n"
             "    highp vec4 result = tex * 0.9;\n" // light source
-            "    for (int i = 0; i < NUM_LIGHTS; ++i) {\n"
-            "        highp vec3 toLight = lights[i] - p;\n"
-            "        highp vec3 toLightN = normalize(toLight);\n"
-            "        highp float normalDotLight = dot(toLightN, normal);\n"
-            "        highp float lightDistance = length(toLight);\n"
-            "        highp float reflectionDotView = max(0.0, dot(normalize(((2.0 * normal) * normalDotLight) - toLightN), toEyeN));\n"
-            "        highp vec3 specular = 0.5 * vec3(0.75 * pow(reflectionDotView, 8.0) / max(1.5, 0.8 * lightDistance));\n"
-            "        if (i < numLights)\n"
-            "            result += vec4(specular, 1.0);\n"
-            "    }\n"
+            "LIGHTS_LOOP"
             "    highp vec4 blend = mix(vec4(0.0), result * tex.a, (1.0 - smoothstep(0.5 - pixelSize.x, 0.5, dt.x)) * (1.0 - smoothstep(0.5 - pixelSize.y, 0.5, dt.y)));\n"
             "    gl_FragColor = mix(min(blend, vec4(1.0)) * focusColor, tex, focusColor);\n"
             "}\n";
 
-    fsrc.replace("NUM_LIGHTS", QByteArray::number(map.maxLights()));
+    QByteArray lightSrc =
+        "        highp vec3 toLight = lights[i] - p;\n"
+        "        highp vec3 toLightN = normalize(toLight);\n"
+        "        highp float normalDotLight = dot(toLightN, normal);\n"
+        "        highp float lightDistance = length(toLight);\n"
+        "        highp float reflectionDotView = max(0.0, dot(normalize(((2.0 * normal) * normalDotLight) - toLightN), toEyeN));\n"
+        "        highp vec3 specular = 0.5 * vec3(0.75 * pow(reflectionDotView, 8.0) / max(1.5, 0.8 * lightDistance));\n"
+        "        result += vec4(specular, 1.0);\n";
+
+    QList<QByteArray> attributes;
+    attributes << "cornerAttr";
+
+    m_cornerAttr = 0;
+
+    for (int zone = 0; zone < map.numZones(); ++zone) {
+        // simple shading ignores the lights, so one variant serves all zones
+        int count = useSimpleShading() ? 0 : map.lights(zone).size();
+        if (m_programs.contains(count))
+            continue;
+
+        Program *program = new Program;
+        program->program = generateShaderProgram(parent, vsrc, specializeLights(fsrc, lightSrc, count), attributes);
+        program->matrixUniform = program->program->uniformLocation("matrix");
+        program->centerUniform = program->program->uniformLocation("center");
+        program->rightUniform = program->program->uniformLocation("right");
+        program->upUniform = program->program->uniformLocation("up");
+        program->yInvertedUniform = program->program->uniformLocation("yInverted");
+        program->focusColorUniform = program->program->uniformLocation("focusColor");
+        program->textureScaleUniform = program->program->uniformLocation("textureScale");
+        program->pixelSizeUniform = program->program->uniformLocation("pixelSize");
+        program->eyeUniform = program->program->uniformLocation("eye");
+        program->normalUniform = program->program->uniformLocation("normal");
+        program->lightsUniform = program->program->uniformLocation("lights");
+        program->uniforms.setProgram(program->program);
+
+        m_programs.insert(count, program);
+    }
+
+    // unit quad as a triangle strip, top left first, (0, 0) is the bottom left corner
+    const QVector2D corners[] =
+    {
+        QVector2D(0, 1), QVector2D(1, 1), QVector2D(0, 0), QVector2D(1, 0)
+    };
+
+    m_quadData = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_quadData->create();
+    m_quadData->bind();
+    m_quadData->allocate(corners, sizeof(corners));
+    m_quadData->release();
+
+    m_quadArray = new VertexArray;
+    m_quadArray->addAttribute(m_cornerAttr, 2);
+    m_quadArray->create(*m_quadData);
+
+    QImage placeholder(1, 1, QImage::Format_ARGB32_Premultiplied);
+    placeholder.fill(qRgb(32, 32, 32));
+    m_placeholderTexture = generateTexture(placeholder, false, false);
+}
+
+void SurfaceItem::setPos(const QVector3D &pos)
+{
+    m_pos = pos;
+    updateGeometry();
+}
 
-    m_program = generateShaderProgram(parent, vsrc, fsrc);
+void SurfaceItem::setNormal(const QVector3D &normal)
+{
+    m_normal = normal;
+    updateGeometry();
+}
 
-    m_vertexAttr = m_program->attributeLocation("vertexAttr");
-    m_texCoordAttr = m_program->attributeLocation("texCoordAttr");
-    m_matrixUniform = m_program->uniformLocation("matrix");
-    m_focusColorUniform = m_program->uniformLocation("focusColor");
-    m_pixelSizeUniform = m_program->uniformLocation("pixelSize");
-    m_eyeUniform = m_program->uniformLocation("eye");
-    m_normalUniform = m_program->uniformLocation("normal");
-    m_lightsUniform = m_program->uniformLocation("lights");
-    m_numLightsUniform = m_program->uniformLocation("numLights");
+void SurfaceItem::setDepthOffset(qreal offset)
+{
+    // only restacks within a zone, so the zone buckets stay valid
+    if (offset != m_depthOffset) {
+        m_depthOffset = offset;
+        m_verticesValid = false;
+    }
 }
 
 void SurfaceItem::setHeight(qreal height)
 {
     m_height = qBound(qreal(0.4), height, maxHeight());
+    updateGeometry();
+}
+
+void SurfaceItem::updateGeometry()
+{
+    m_verticesValid = false;
+    emit geometryChanged();
 }
 
 qreal SurfaceItem::height() const
@@ -177,8 +324,11 @@ qreal SurfaceItem::maxHeight() const
     return 0.8;
 }
 
-QVector<QVector3D> SurfaceItem::vertices() const
+const QVector<QVector3D> &SurfaceItem::vertices() const
 {
+    if (m_verticesValid)
+        return m_vertices;
+
     QSize size = m_surface->size();
 
     qreal w = (m_height * size.width()) / size.height();
@@ -204,33 +354,43 @@ QVector<QVector3D> SurfaceItem::vertices() const
     QVector3D vc(right.x(), bottom, right.y());
     QVector3D vd(left.x(), bottom, left.y());
 
-    QVector<QVector3D> result;
-    result << va << vb << vc << vd;
-    return result;
+    m_vertices.resize(4);
+    m_vertices[0] = va;
+    m_vertices[1] = vb;
+    m_vertices[2] = vc;
+    m_vertices[3] = vd;
+
+    // the corners keep changing until the appear animation is done
+    m_verticesValid = scale >= 1;
+    return m_vertices;
 }
 
 uint SurfaceItem::textureId() const
 {
     uint id = 0;
     QOpenGLContext *ctx = QOpenGLContext::currentContext();
+
     if (m_surface->type() == WaylandSurface::Texture) {
         id = m_surface->texture(ctx);
+        GLState::textureBindingChanged();
     } else {
+        // only a resize uploads here, damage waits for the UploadScheduler
         QImage image = m_surface->image();
-        if (m_textureSize != image.size()) {
-            if (!m_textureSize.isNull())
-                glDeleteTextures(1, &m_textureId);
-            const_cast<SurfaceItem *>(this)->m_textureId = generateTexture(image, true, false);
-            const_cast<SurfaceItem *>(this)->m_textureSize = image.size();
-        } else if (!m_dirty.isNull()) {
-            updateSubImage(m_textureId, image, m_dirty, true);
-        }
-        const_cast<SurfaceItem *>(this)->m_dirty = QRect();
-        id = m_textureId;
+        if (m_evicted)
+            const_cast<SurfaceItem *>(this)->restoreTexture(image);
+        else if (m_textureSize != image.size())
+            const_cast<SurfaceItem *>(this)->resizeTexture(image);
+
+        if (m_restoring && m_dirty.isEmpty())
+            const_cast<SurfaceItem *>(this)->m_restoring = false;
+
+        id = m_restoring ? m_placeholderTexture : m_textureId;
     }
 
-    if (m_mipmap && canUseMipmaps(m_textureSize)) {
-        glBindTexture(GL_TEXTURE_2D, id);
+    // a restoring shm texture is not drawn yet, its mipmaps follow once it is refilled,
+    // and mipmaps from the CPU chain must not be replaced by ones filtered over stale texels
+    if (m_mipmap && !m_restoring && !chainMipmaps() && canUseMipmaps(m_textureSize)) {
+        GLState::bindTexture(id);
         ctx->functions()->glGenerateMipmap(GL_TEXTURE_2D);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         const_cast<bool &>(m_mipmap) = false;
@@ -239,81 +399,381 @@ uint SurfaceItem::textureId() const
     return id;
 }
 
-void SurfaceItem::surfaceDamaged(const QRect &rect)
+QRectF SurfaceItem::textureRect() const
 {
-    m_dirty = m_dirty | rect;
+    if (m_surface->type() == WaylandSurface::Texture || m_storageSize.isEmpty())
+        return QRectF(0, 0, 1, 1);
+
+    return QRectF(0, 0, qreal(m_textureSize.width()) / m_storageSize.width(),
+                  qreal(m_textureSize.height()) / m_storageSize.height());
 }
 
-QSize SurfaceItem::size() const
+bool SurfaceItem::takeUsed()
 {
-    return m_surface->size();
+    bool used = m_used;
+    m_used = false;
+    return used;
 }
 
-void SurfaceItem::render(const Map &map, const Camera &camera) const
+int SurfaceItem::frameCallbackRemaining() const
 {
-    int zone = map.zone(vertices().at(0));
+    if (m_frameCallbackTime.isNull())
+        return 0;
+    return qMax(0, m_frameCallbackInterval - m_frameCallbackTime.elapsed());
+}
 
-    GLuint tex = textureId();
+void SurfaceItem::frameCallbackSent()
+{
+    m_frameCallbackTime.start();
+}
+
+qint64 SurfaceItem::textureBytes() const
+{
+    return m_textureId ? TexturePool::textureBytes(m_storageSize) : 0;
+}
+
+void SurfaceItem::evictTexture()
+{
+    if (!m_textureId)
+        return;
+
+    TexturePool::Texture texture;
+    texture.id = m_textureId;
+    texture.size = m_storageSize;
+    TexturePool::destroy(texture);
+
+    // the next textureId() allocates the texture again and has the UploadScheduler refill it
+    m_evicted = true;
+    m_restoring = false;
+    m_textureId = 0;
+    m_textureSize = QSize();
+    m_storageSize = QSize();
+    m_dirty.clear();
+    m_backlogBytes = 0;
+    m_mipmapChain.clear();
+    m_mipmapsStale = false;
+}
+
+void SurfaceItem::restoreTexture(const QImage &image)
+{
+    TexturePool::Texture texture = TexturePool::acquire(image.size(), canUseMipmaps(image.size()));
+    m_textureId = texture.id;
+    m_storageSize = texture.size;
+    m_textureSize = image.size();
+
+    // the whole buffer goes through the upload budget like any other damage
+    m_dirty.clear();
+    addDamage(m_dirty, image.rect());
+    m_damageTime.start();
+    m_backlogBytes = 0;
+
+    m_evicted = false;
+    m_restoring = true;
+}
+
+void SurfaceItem::resizeTexture(const QImage &image)
+{
+    m_evicted = false;
+    m_restoring = false;
+
+    const bool mipmaps = canUseMipmaps(image.size());
+
+    // sizes within the same size class keep their texture
+    bool fresh = !m_textureId || TexturePool::sizeClass(image.size()) != m_storageSize;
+    if (fresh) {
+        TexturePool::Texture texture;
+        texture.id = m_textureId;
+        texture.size = m_storageSize;
+        TexturePool::release(texture);
+
+        texture = TexturePool::acquire(image.size(), mipmaps);
+        m_textureId = texture.id;
+        m_storageSize = texture.size;
+    }
+
+    m_textureSize = image.size();
+
+    updateSubImage(m_textureId, image, image.rect(), false);
 
-    if (zone < 0)
+    QVector<TextureUploader::Region> extra = edgePadding(image, QVector<QRect>() << image.rect());
+
+    if (mipmaps && chainMipmaps()) {
+        m_mipmapChain.clear();
+        extra += mipmapRegions(image, QVector<QRect>());
+    }
+
+    for (int i = 0; i < extra.size(); ++i)
+        updateSubImage(m_textureId, extra.at(i).pixels, extra.at(i).pos, extra.at(i).level);
+
+    addUploadBytes(m_surface, image.width() * image.height() * 4);
+    m_dirty.clear();
+    m_backlogBytes = 0;
+
+    if (!mipmaps || chainMipmaps())
         return;
 
-    m_program->bind();
-    m_program->setUniformValue(m_matrixUniform, camera.viewProjectionMatrix());
+    if (fresh || mipmapMode() == FullMipmaps) {
+        GLState::bindTexture(m_textureId);
+        QOpenGLContext::currentContext()->functions()->glGenerateMipmap(GL_TEXTURE_2D);
+    } else {
+        m_mipmapsStale = true;
+    }
+}
+
+bool SurfaceItem::chainMipmaps() const
+{
+    // glGenerateMipmap would filter the stale texels past the image in larger pooled
+    // storage into the coarser levels, so those are only built over the image on the CPU
+    return m_surface->type() != WaylandSurface::Texture
+        && (mipmapMode() == RegionMipmaps || m_storageSize != m_textureSize);
+}
+
+QVector<TextureUploader::Region> SurfaceItem::edgePadding(const QImage &image, const QVector<QRect> &rects, int level) const
+{
+    QVector<TextureUploader::Region> padding;
+
+    const int w = image.width();
+    const int h = image.height();
+
+    bool right = false;
+    bool bottom = false;
+    for (int i = 0; i < rects.size(); ++i) {
+        right = right || rects.at(i).right() == w - 1;
+        bottom = bottom || rects.at(i).bottom() == h - 1;
+    }
+
+    // linear filtering reads one texel past the image into whatever pooled storage
+    // held before, so the last column and row are repeated there, and coarser levels
+    // need two as their rounded down size can end half a texel short of the image
+    const int border = level ? 2 : 1;
+    const int padWidth = qMin(border, qMax(1, m_storageSize.width() >> level) - w);
+    const int padHeight = qMin(border, qMax(1, m_storageSize.height() >> level) - h);
+
+    right = right && padWidth > 0;
+    bottom = bottom && padHeight > 0;
+
+    if (right) {
+        TextureUploader::Region region = { level, QPoint(w, 0), image.copy(w - 1, 0, 1, h).scaled(padWidth, h) };
+        padding << region;
+    }
 
+    if (bottom) {
+        TextureUploader::Region region = { level, QPoint(0, h), image.copy(0, h - 1, w, 1).scaled(w, padHeight) };
+        padding << region;
+    }
+
+    if (right && bottom) {
+        TextureUploader::Region region = { level, QPoint(w, h), image.copy(w - 1, h - 1, 1, 1).scaled(padWidth, padHeight) };
+        padding << region;
+    }
+
+    return padding;
+}
+
+QVector<TextureUploader::Region> SurfaceItem::mipmapRegions(const QImage &image, const QVector<QRect> &rects)
+{
+    const QVector<MipmapChain::Region> levels = m_mipmapChain.update(image, rects);
+
+    QVector<TextureUploader::Region> regions;
+    QVector<QVector<QRect> > levelRects;
+
+    for (int i = 0; i < levels.size(); ++i) {
+        const MipmapChain::Region &level = levels.at(i);
+        TextureUploader::Region region = { level.level, level.rect.topLeft(),
+                                           m_mipmapChain.level(level.level).copy(level.rect) };
+        regions << region;
+
+        if (levelRects.size() <= level.level)
+            levelRects.resize(level.level + 1);
+        levelRects[level.level] << level.rect;
+    }
+
+    for (int level = 1; level < levelRects.size(); ++level)
+        regions += edgePadding(m_mipmapChain.level(level), levelRects.at(level), level);
+
+    return regions;
+}
+
+qint64 SurfaceItem::pendingBytes() const
+{
+    qint64 bytes = 0;
+    for (int i = 0; i < m_dirty.size(); ++i)
+        bytes += m_dirty.at(i).width() * m_dirty.at(i).height() * 4;
+    return bytes;
+}
+
+int SurfaceItem::damageAge() const
+{
+    return m_dirty.isEmpty() ? 0 : m_damageTime.elapsed();
+}
+
+bool SurfaceItem::backlogExceeded() const
+{
     QSize size = m_surface->size();
-    m_program->setUniformValue(m_pixelSizeUniform, 5. / size.width(), 5. / size.height());
-    m_program->setUniformValue(m_eyeUniform, camera.viewPos());
-    m_program->setUniformValue(m_focusColorUniform, GLfloat(m_opacity));
-    m_program->setUniformValueArray(m_lightsUniform, map.lights(zone).constData(), map.lights(zone).size());
-    m_program->setUniformValue(m_numLightsUniform, map.lights(zone).size());
+    return m_backlogBytes >= qint64(backlogSurfaces) * size.width() * size.height() * 4;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
+bool SurfaceItem::thumbnailDue() const
+{
+    return m_uploadTime.isNull() || m_uploadTime.elapsed() >= thumbnailInterval();
+}
 
-    QVector<QVector3D> v = vertices();
+int SurfaceItem::thumbnailInterval()
+{
+    // docked thumbnails are refreshed at a fraction of the frame rate
+    return 250;
+}
 
-    QVector3D va = v[0];
-    QVector3D vb = v[1];
-    QVector3D vc = v[2];
-    QVector3D vd = v[3];
+qreal SurfaceItem::takeScreenArea()
+{
+    qreal area = m_screenArea;
+    m_screenArea = 0;
+    m_distance = FLT_MAX;
+    return area;
+}
 
-    QVector<QVector3D> vertexBuffer;
-    vertexBuffer << va << vb << vd << vd << vb << vc;
+bool SurfaceItem::uploadDamage()
+{
+    if (!hasPendingDamage())
+        return false;
+
+    // a resized buffer is uploaded whole by textureId()
+    QImage image = m_surface->image();
+    if (image.size() != m_textureSize) {
+        textureId();
+        return true;
+    }
 
-    qreal y1 = 0;
-    qreal y2 = 1;
+    QVector<QRect> rects;
+    int bytes = 0;
+    for (int i = 0; i < m_dirty.size(); ++i) {
+        QRect rect = m_dirty.at(i) & image.rect();
+        if (rect.isEmpty())
+            continue;
+        rects << rect;
+        bytes += rect.width() * rect.height() * 4;
+    }
 
-    if (m_surface->isYInverted())
-        qSwap(y1, y2);
+    const MipmapMode mode = mipmapMode();
+    const bool mipmaps = canUseMipmaps(image.size());
 
-    QVector<QVector2D> texCoordBuffer;
-    texCoordBuffer << QVector2D(0, y2) << QVector2D(1, y2)
-                   << QVector2D(0, y1) << QVector2D(0, y1)
-                   << QVector2D(1, y2) << QVector2D(1, y1);
+    QVector<TextureUploader::Region> extra = edgePadding(image, rects);
 
-    m_program->setUniformValue(m_normalUniform, -QVector3D::crossProduct(vb - va, vc - va).normalized());
+    // mip regions are filtered here but land together with level 0
+    const bool chain = mipmaps && chainMipmaps();
+    if (chain)
+        extra += mipmapRegions(image, rects);
 
-    m_program->enableAttributeArray(m_vertexAttr);
-    m_program->setAttributeArray(m_vertexAttr, vertexBuffer.constData());
-    m_program->enableAttributeArray(m_texCoordAttr);
-    m_program->setAttributeArray(m_texCoordAttr, texCoordBuffer.constData());
+    // a restored texture has no mip levels yet, so lazy mode builds them right away
+    const bool generateMipmaps = mipmaps && !chain && (mode == FullMipmaps || (mode == LazyMipmaps && m_restoring));
 
-    glEnable(GL_BLEND);
-    glDisable(GL_CULL_FACE);
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    // all rectangles go in one upload so that the texture never shows half a commit
+    if (!TextureUploader::instance()->upload(m_textureId, image, rects, generateMipmaps, extra))
+        return false;
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    addUploadBytes(m_surface, bytes);
+    m_dirty.clear();
+    m_backlogBytes = 0;
+    m_uploadTime.start();
 
-    glDisable(GL_BLEND);
+    if (mipmaps && !chain && mode == LazyMipmaps && !generateMipmaps)
+        m_mipmapsStale = true;
 
-    m_program->disableAttributeArray(m_texCoordAttr);
-    m_program->disableAttributeArray(m_vertexAttr);
+    return true;
+}
+
+void SurfaceItem::surfaceDamaged(const QRect &rect)
+{
+    // texture buffers are used as they are
+    if (m_surface->type() == WaylandSurface::Texture)
+        return;
+
+    if (m_dirty.isEmpty())
+        m_damageTime.start();
+
+    addDamage(m_dirty, rect);
+    m_backlogBytes += rect.width() * rect.height() * 4;
+}
+
+QSize SurfaceItem::size() const
+{
+    return m_surface->size();
+}
+
+void SurfaceItem::render(const Map &map, const Camera &camera, int zone) const
+{
+    GLuint tex = textureId();
+    const_cast<SurfaceItem *>(this)->m_used = true;
+
+    const QVector<QVector3D> lights = map.lights(zone);
+    Program *program = m_programs.value(useSimpleShading() ? 0 : lights.size());
+    UniformCache &uniforms = program->uniforms;
+
+    GLState::useProgram(program->program);
+    uniforms.setValue(program->matrixUniform, camera.viewProjectionMatrix());
+
+    QSize size = m_surface->size();
+    uniforms.setValue(program->pixelSizeUniform, 5. / size.width(), 5. / size.height());
+    uniforms.setValue(program->eyeUniform, camera.viewPos());
+    uniforms.setValue(program->focusColorUniform, GLfloat(m_opacity));
+
+    // pooled textures can be larger than the surface
+    QRectF textureRect = this->textureRect();
+    uniforms.setValue(program->textureScaleUniform, textureRect.width(), textureRect.height());
+    uniforms.setValueArray(program->lightsUniform, lights, zone);
+
+    GLState::activeTexture(GL_TEXTURE0);
+    GLState::bindTexture(tex);
+
+    QRectF screenRect = camera.toScreenRect(vertices());
+    const_cast<SurfaceItem *>(this)->m_screenArea = qMax(m_screenArea, screenRect.width() * screenRect.height());
+    const_cast<SurfaceItem *>(this)->m_distance = qMin(m_distance, qreal((m_pos - camera.viewPos()).length()));
+
+    // lazy mipmaps are only rebuilt once the surface is drawn smaller than its texture
+    if (m_mipmapsStale && tex == m_textureId) {
+        if (screenRect.width() < m_textureSize.width() || screenRect.height() < m_textureSize.height()) {
+            QOpenGLContext::currentContext()->functions()->glGenerateMipmap(GL_TEXTURE_2D);
+            const_cast<SurfaceItem *>(this)->m_mipmapsStale = false;
+        }
+    }
+
+    qreal scale = qMin(1.0, m_time.elapsed() * 0.002);
+
+    qreal w = (m_height * size.width()) / size.height();
+    qreal h = m_height;
+
+    QVector3D perp = QVector3D::crossProduct(QVector3D(0, 1, 0), m_normal);
+    QVector3D right = QVector3D(perp.x(), 0, perp.z()).normalized() * w * scale;
+
+    uniforms.setValue(program->centerUniform, m_pos + m_normal * m_depthOffset);
+    uniforms.setValue(program->rightUniform, right);
+    uniforms.setValue(program->upUniform, QVector3D(0, h * scale, 0));
+    uniforms.setValue(program->yInvertedUniform, GLfloat(m_surface->isYInverted() ? 1 : 0));
+    uniforms.setValue(program->normalUniform, m_normal);
+
+    m_quadArray->bind();
+
+    GLState::enable(GL_BLEND);
+    GLState::disable(GL_CULL_FACE);
+    GLState::blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    GLState::disable(GL_BLEND);
+
+    m_quadArray->release();
 
 #if 0
     QOpenGLPaintDevice device(camera.viewSize());
     QPainter p(&device);
 
+    QVector<QVector3D> v = vertices();
+
+    QVector3D va = v[0];
+    QVector3D vb = v[1];
+    QVector3D vc = v[2];
+    QVector3D vd = v[3];
+
     va = camera.viewProjectionMatrix().map(va);
     vb = camera.viewProjectionMatrix().map(vb);
     vc = camera.viewProjectionMatrix().map(vc);
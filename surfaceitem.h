@@ -23,6 +23,7 @@
 #ifndef SURFACEITEM_H
 #define SURFACEITEM_H
 
+#include <QHash>
 #include <QImage>
 #include <QTime>
 #include <QVector>
@@ -31,12 +32,19 @@
 
 #include <QPropertyAnimation>
 
+#include "mipmapchain.h"
+#include "textureuploader.h"
+#include "uniformcache.h"
+
 class Camera;
 class Map;
 class WaylandSurface;
 
+class QOpenGLBuffer;
 class QOpenGLShaderProgram;
 
+class VertexArray;
+
 class SurfaceItem : public QObject
 {
     Q_OBJECT
@@ -45,17 +53,18 @@ public:
     SurfaceItem(WaylandSurface *surface);
     ~SurfaceItem();
 
-    QVector<QVector3D> vertices() const;
+    // corners of the quad, cached until the geometry changes
+    const QVector<QVector3D> &vertices() const;
 
     WaylandSurface *surface() const
     {
         return m_surface;
     }
 
-    void setPos(const QVector3D &pos) { m_pos = pos; }
-    void setNormal(const QVector3D &normal) { m_normal = normal; }
+    void setPos(const QVector3D &pos);
+    void setNormal(const QVector3D &normal);
 
-    void setDepthOffset(qreal offset) { m_depthOffset = offset; }
+    void setDepthOffset(qreal offset);
     qreal depthOffset() const { return m_depthOffset; }
 
     qreal height() const;
@@ -67,9 +76,46 @@ public:
     void setMipmap(bool mipmap) { m_mipmap = mipmap; }
 
     uint textureId() const;
+
+    // part of the texture covered by the surface, in texture coordinates
+    QRectF textureRect() const;
+
+    // damage is uploaded by the UploadScheduler rather than when the texture is used
+    bool hasPendingDamage() const { return !m_dirty.isEmpty() && m_textureId; }
+    qint64 pendingBytes() const;
+    int damageAge() const;
+    bool backlogExceeded() const;
+    bool thumbnailDue() const;
+    bool uploadDamage();
+
+    // largest screen area covered since the last call, zero when not drawn
+    qreal takeScreenArea();
+    qreal screenArea() const { return m_screenArea; }
+
+    // distance from the closest camera the surface was drawn from since takeScreenArea()
+    qreal distance() const { return m_distance; }
+
+    // whether the surface was drawn since the last call, as a sprite or by render()
+    void markUsed() { m_used = true; }
+    bool takeUsed();
+
+    bool used() const { return m_used; }
+
+    // frame callbacks are sent at most once per interval, as set by the view's FrameRatePolicy
+    void setFrameCallbackInterval(int msecs) { m_frameCallbackInterval = msecs; }
+    int frameCallbackInterval() const { return m_frameCallbackInterval; }
+    int frameCallbackRemaining() const;
+    void frameCallbackSent();
+
+    // bytes of texture memory held, evicting frees them until the texture is used again
+    qint64 textureBytes() const;
+    void evictTexture();
+    bool textureEvicted() const { return m_evicted; }
+
+    static int thumbnailInterval();
     QSize size() const;
 
-    void render(const Map &map, const Camera &camera) const;
+    void render(const Map &map, const Camera &camera, int zone) const;
     void setOpacity(qreal op);
     qreal opacity() const { return m_opacity; }
 
@@ -81,8 +127,16 @@ private slots:
 
 signals:
     void opacityChanged();
+    void geometryChanged();
 
 private:
+    void updateGeometry();
+    void resizeTexture(const QImage &image);
+    void restoreTexture(const QImage &image);
+    bool chainMipmaps() const;
+    QVector<TextureUploader::Region> edgePadding(const QImage &image, const QVector<QRect> &rects, int level = 0) const;
+    QVector<TextureUploader::Region> mipmapRegions(const QImage &image, const QVector<QRect> &rects);
+
     WaylandSurface *m_surface;
 
     QVector3D m_pos;
@@ -90,26 +144,58 @@ private:
     qreal m_depthOffset;
     qreal m_opacity;
 
-    static QOpenGLShaderProgram *m_program;
+    struct Program {
+        QOpenGLShaderProgram *program;
+        UniformCache uniforms;
+
+        uint matrixUniform;
+        uint centerUniform;
+        uint rightUniform;
+        uint upUniform;
+        uint yInvertedUniform;
+        uint pixelSizeUniform;
+        uint eyeUniform;
+        uint normalUniform;
+        uint lightsUniform;
+        uint focusColorUniform;
+        uint textureScaleUniform;
+    };
 
-    static uint m_vertexAttr;
-    static uint m_texCoordAttr;
-    static uint m_matrixUniform;
-    static uint m_pixelSizeUniform;
-    static uint m_eyeUniform;
-    static uint m_normalUniform;
-    static uint m_lightsUniform;
-    static uint m_numLightsUniform;
-    static uint m_focusColorUniform;
+    // shader variants keyed by the number of lights in a zone
+    static QHash<int, Program *> m_programs;
+
+    static QOpenGLBuffer *m_quadData;
+    static VertexArray *m_quadArray;
+
+    static uint m_cornerAttr;
+
+    // drawn while an evicted texture is uploaded again
+    static GLuint m_placeholderTexture;
 
     uint m_textureId;
-    QRect m_dirty;
+    QVector<QRect> m_dirty;
+    qint64 m_backlogBytes;
+    QTime m_damageTime;
+    QTime m_uploadTime;
+    qreal m_screenArea;
+    qreal m_distance;
+    bool m_used;
+    QTime m_frameCallbackTime;
+    int m_frameCallbackInterval;
     QSize m_textureSize;
+    QSize m_storageSize;
+    bool m_evicted;
+    bool m_restoring;
 
     QTime m_time;
     qreal m_height;
+    mutable QVector<QVector3D> m_vertices;
+    mutable bool m_verticesValid;
     bool m_focus;
     bool m_mipmap;
+    bool m_mipmapsStale;
+
+    MipmapChain m_mipmapChain;
 
     QPropertyAnimation *m_opacityAnimation;
 };
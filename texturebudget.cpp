@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "texturebudget.h"
+
+#include "common.h"
+#include "surfaceitem.h"
+#include "texturepool.h"
+
+#include <QPair>
+#include <QVector>
+#include <QtAlgorithms>
+
+namespace {
+    // surfaces drawn within this many frames are never evicted
+    const int minHiddenFrames = 120;
+}
+
+TextureBudget::TextureBudget()
+    : m_frame(0)
+{
+}
+
+void TextureBudget::enforce(const QList<SurfaceItem *> &surfaces)
+{
+    ++m_frame;
+
+    // rebuilt every frame so that destroyed surfaces drop out
+    QHash<SurfaceItem *, int> lastUsed;
+    for (int i = 0; i < surfaces.size(); ++i) {
+        SurfaceItem *item = surfaces.at(i);
+        lastUsed.insert(item, item->takeUsed() ? m_frame : m_lastUsed.value(item, m_frame));
+    }
+    m_lastUsed = lastUsed;
+
+    const qint64 budget = textureBudgetBytes();
+    if (TexturePool::residentBytes() <= budget)
+        return;
+
+    // textures kept for reuse go before anything in use
+    TexturePool::trim(budget);
+    if (TexturePool::residentBytes() <= budget)
+        return;
+
+    QVector<QPair<int, SurfaceItem *> > candidates;
+    QHash<SurfaceItem *, int>::const_iterator it;
+    for (it = m_lastUsed.constBegin(); it != m_lastUsed.constEnd(); ++it) {
+        if (it.key()->textureBytes() > 0 && m_frame - it.value() >= minHiddenFrames)
+            candidates << qMakePair(it.value(), it.key());
+    }
+
+    qSort(candidates.begin(), candidates.end(), lessRecentlyUsed);
+
+    for (int i = 0; i < candidates.size() && TexturePool::residentBytes() > budget; ++i) {
+        candidates.at(i).second->evictTexture();
+        ++frameStats().texturesEvicted;
+    }
+}
+
+bool TextureBudget::lessRecentlyUsed(const QPair<int, SurfaceItem *> &a, const QPair<int, SurfaceItem *> &b)
+{
+    return a.first < b.first;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TEXTUREBUDGET_H
+#define TEXTUREBUDGET_H
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+
+class SurfaceItem;
+
+// Keeps resident texture memory within --texture-budget by evicting the
+// textures of surfaces that have not been drawn for a while, least recently
+// drawn first. Evicted surfaces rebuild their texture when drawn again.
+class TextureBudget
+{
+public:
+    TextureBudget();
+
+    void enforce(const QList<SurfaceItem *> &surfaces);
+
+private:
+    static bool lessRecentlyUsed(const QPair<int, SurfaceItem *> &a, const QPair<int, SurfaceItem *> &b);
+
+    int m_frame;
+    QHash<SurfaceItem *, int> m_lastUsed;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "texturepool.h"
+
+#include "common.h"
+#include "glstate.h"
+
+#include <QHash>
+#include <QList>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QPair>
+
+namespace {
+    // pooled textures beyond this are deleted instead of kept for reuse
+    const qint64 maxPooledBytes = 64 * 1024 * 1024;
+
+    const int granularity = 256;
+
+    typedef QHash<QPair<int, int>, QList<GLuint> > FreeLists;
+
+    FreeLists freeLists;
+    qint64 totalBytes = 0;
+    qint64 freeBytes = 0;
+
+    int roundUp(int value)
+    {
+        int powerOfTwo = 1;
+        while (powerOfTwo < value)
+            powerOfTwo *= 2;
+
+        // large surfaces grow in steps instead of doubling their memory
+        int step = (value + granularity - 1) / granularity * granularity;
+
+        return qMin(powerOfTwo, step);
+    }
+}
+
+QSize TexturePool::sizeClass(const QSize &size)
+{
+    return QSize(roundUp(size.width()), roundUp(size.height()));
+}
+
+TexturePool::Texture TexturePool::acquire(const QSize &size, bool mipmaps)
+{
+    Texture texture;
+    texture.size = sizeClass(size);
+
+    FrameStats &stats = frameStats();
+
+    FreeLists::iterator it = freeLists.find(qMakePair(texture.size.width(), texture.size.height()));
+    if (it != freeLists.end() && !it.value().isEmpty()) {
+        texture.id = it.value().takeLast();
+        freeBytes -= textureBytes(texture.size);
+        ++stats.texturePoolHits;
+
+        // the previous owner might have used the texture with or without mipmaps
+        GLState::bindTexture(texture.id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    } else {
+        texture.id = allocateTexture(texture.size, mipmaps, false);
+        totalBytes += textureBytes(texture.size);
+        ++stats.texturePoolMisses;
+    }
+
+    // the contents do not matter yet, the owner uploads whatever part it samples
+    if (mipmaps) {
+        GLState::bindTexture(texture.id);
+        QOpenGLContext::currentContext()->functions()->glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    return texture;
+}
+
+void TexturePool::release(const Texture &texture)
+{
+    if (!texture.id)
+        return;
+
+    qint64 bytes = textureBytes(texture.size);
+
+    if (freeBytes + bytes > maxPooledBytes) {
+        destroy(texture);
+        return;
+    }
+
+    freeLists[qMakePair(texture.size.width(), texture.size.height())] << texture.id;
+    freeBytes += bytes;
+}
+
+void TexturePool::destroy(const Texture &texture)
+{
+    if (!texture.id)
+        return;
+
+    glDeleteTextures(1, &texture.id);
+    GLState::textureBindingChanged();
+    totalBytes -= textureBytes(texture.size);
+}
+
+void TexturePool::trim(qint64 budget)
+{
+    FreeLists::iterator it = freeLists.begin();
+    while (totalBytes > budget && it != freeLists.end()) {
+        Texture texture;
+        texture.size = QSize(it.key().first, it.key().second);
+
+        while (totalBytes > budget && !it.value().isEmpty()) {
+            texture.id = it.value().takeLast();
+            freeBytes -= textureBytes(texture.size);
+            destroy(texture);
+        }
+
+        if (it.value().isEmpty())
+            it = freeLists.erase(it);
+        else
+            ++it;
+    }
+}
+
+qint64 TexturePool::textureBytes(const QSize &size)
+{
+    // with mipmaps the chain adds up to a third of level 0
+    return qint64(size.width()) * size.height() * 4 * 4 / 3;
+}
+
+qint64 TexturePool::residentBytes()
+{
+    return totalBytes;
+}
+
+qint64 TexturePool::pooledBytes()
+{
+    return freeBytes;
+}
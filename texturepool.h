@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TEXTUREPOOL_H
+#define TEXTUREPOOL_H
+
+#include <QSize>
+
+#include <qopengl.h>
+
+// Recycles surface textures by size class, so that resizing a surface reuses
+// storage instead of reallocating it. A texture can be larger than the image
+// it holds, see SurfaceItem::textureRect().
+class TexturePool
+{
+public:
+    struct Texture {
+        Texture() : id(0) {}
+
+        GLuint id;
+        QSize size;
+    };
+
+    static QSize sizeClass(const QSize &size);
+
+    // with mipmaps all levels are defined, so that they can be updated in parts
+    static Texture acquire(const QSize &size, bool mipmaps);
+    static void release(const Texture &texture);
+    static void destroy(const Texture &texture);
+
+    // deletes pooled textures until the resident bytes fit into budget
+    static void trim(qint64 budget);
+
+    static qint64 textureBytes(const QSize &size);
+
+    // resident bytes cover textures in use as well as those kept for reuse
+    static qint64 residentBytes();
+    static qint64 pooledBytes();
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "textureuploader.h"
+
+#include "common.h"
+#include "glstate.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+namespace {
+    typedef void *(QOPENGLF_APIENTRYP FenceSync)(GLenum condition, GLbitfield flags);
+    typedef GLenum (QOPENGLF_APIENTRYP ClientWaitSync)(void *sync, GLbitfield flags, quint64 timeout);
+    typedef void (QOPENGLF_APIENTRYP DeleteSync)(void *sync);
+
+    const GLenum syncGpuCommandsComplete = 0x9117;
+    const GLenum alreadySignaled = 0x911A;
+    const GLenum conditionSatisfied = 0x911C;
+    const GLbitfield syncFlushCommandsBit = 0x00000001;
+
+    FenceSync fenceSync = 0;
+    ClientWaitSync clientWaitSync = 0;
+    DeleteSync deleteSync = 0;
+}
+
+TextureUploader *TextureUploader::m_instance = 0;
+
+TextureUploader::TextureUploader(QObject *parent)
+    : QObject(parent)
+    , m_head(0)
+    , m_count(0)
+    , m_async(false)
+{
+    m_instance = this;
+
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+
+#ifndef QT_OPENGL_ES_2
+    // QOpenGLBuffer::map() needs glMapBuffer, and GLES2 has no pixel unpack buffers
+    const QSurfaceFormat format = ctx->format();
+    const int version = format.majorVersion() * 10 + format.minorVersion();
+
+    m_async = useAsyncUploads()
+        && (version >= 21 || ctx->hasExtension("GL_ARB_pixel_buffer_object"));
+
+    if (m_async && (version >= 32 || ctx->hasExtension("GL_ARB_sync"))) {
+        fenceSync = reinterpret_cast<FenceSync>(ctx->getProcAddress("glFenceSync"));
+        clientWaitSync = reinterpret_cast<ClientWaitSync>(ctx->getProcAddress("glClientWaitSync"));
+        deleteSync = reinterpret_cast<DeleteSync>(ctx->getProcAddress("glDeleteSync"));
+        if (!fenceSync || !clientWaitSync || !deleteSync)
+            fenceSync = 0;
+    }
+#else
+    Q_UNUSED(ctx);
+#endif
+
+    for (int i = 0; i < RingSize; ++i) {
+        Slot &slot = m_slots[i];
+        slot.fence = 0;
+
+        if (m_async) {
+            slot.buffer = QOpenGLBuffer(QOpenGLBuffer::PixelUnpackBuffer);
+            slot.buffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+            slot.buffer.create();
+        }
+    }
+
+    printf("Asynchronous texture uploads: %s, fences: %s\n", m_async ? "yes" : "no", fenceSync ? "yes" : "no");
+}
+
+TextureUploader::~TextureUploader()
+{
+    if (m_instance == this)
+        m_instance = 0;
+}
+
+TextureUploader *TextureUploader::instance()
+{
+    return m_instance;
+}
+
+bool TextureUploader::upload(GLuint texture, const QImage &image, const QVector<QRect> &rects, bool mipmaps,
+                             const QVector<Region> &extra)
+{
+    // damage can lie entirely outside the buffer
+    if (rects.isEmpty() && extra.isEmpty())
+        return true;
+
+    if (!m_async || !hasUploadLayout(image)) {
+        uploadNow(texture, image, rects, mipmaps, extra);
+        return true;
+    }
+
+    reclaim(false);
+
+    // with every slot uploaded but unfinished the GPU is the bottleneck, wait for it
+    if (m_count == RingSize)
+        reclaim(true);
+    if (m_count == RingSize)
+        return false;
+
+    QVector<QImage> pixels;
+    for (int i = 0; i < extra.size(); ++i) {
+        const QImage &region = extra.at(i).pixels;
+        pixels << (hasUploadLayout(region) ? region : region.convertToFormat(QImage::Format_ARGB32));
+    }
+
+    int size = 0;
+    for (int i = 0; i < rects.size(); ++i)
+        size += rects.at(i).width() * rects.at(i).height() * 4;
+    for (int i = 0; i < pixels.size(); ++i)
+        size += pixels.at(i).width() * pixels.at(i).height() * 4;
+
+    Slot &slot = m_slots[(m_head + m_count) % RingSize];
+
+    slot.buffer.bind();
+    // reallocating orphans the previous contents instead of waiting for them
+    slot.buffer.allocate(size);
+    uchar *data = static_cast<uchar *>(slot.buffer.map(QOpenGLBuffer::WriteOnly));
+
+    // the next upload gets another try at mapping
+    if (!data) {
+        slot.buffer.release();
+        qWarning("Failed to map pixel buffer, uploading synchronously");
+        uploadNow(texture, image, rects, mipmaps, extra);
+        return true;
+    }
+
+    // the rows are packed straight from the client buffer, which it may reuse once this returns
+    uchar *dst = data;
+    for (int i = 0; i < rects.size(); ++i) {
+        copyForUpload(image, rects.at(i), dst);
+        dst += rects.at(i).width() * rects.at(i).height() * 4;
+    }
+    for (int i = 0; i < pixels.size(); ++i) {
+        copyForUpload(pixels.at(i), pixels.at(i).rect(), dst);
+        dst += pixels.at(i).width() * pixels.at(i).height() * 4;
+    }
+
+    slot.buffer.unmap();
+
+    GLState::bindTexture(texture);
+
+    const GLenum format = textureUploadFormat();
+
+    // the copy into the texture runs on the GPU, the driver does not wait for it here
+    int offset = 0;
+    for (int i = 0; i < rects.size(); ++i) {
+        const QRect &rect = rects.at(i);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(), format,
+            GL_UNSIGNED_BYTE, reinterpret_cast<GLvoid *>(offset));
+        offset += rect.width() * rect.height() * 4;
+    }
+    for (int i = 0; i < pixels.size(); ++i) {
+        const QImage &region = pixels.at(i);
+        const QPoint &pos = extra.at(i).pos;
+        glTexSubImage2D(GL_TEXTURE_2D, extra.at(i).level, pos.x(), pos.y(), region.width(), region.height(), format,
+            GL_UNSIGNED_BYTE, reinterpret_cast<GLvoid *>(offset));
+        offset += region.width() * region.height() * 4;
+    }
+
+    slot.buffer.release();
+
+    if (mipmaps)
+        QOpenGLContext::currentContext()->functions()->glGenerateMipmap(GL_TEXTURE_2D);
+
+    if (fenceSync)
+        slot.fence = fenceSync(syncGpuCommandsComplete, 0);
+
+    ++m_count;
+
+    return true;
+}
+
+void TextureUploader::uploadNow(GLuint texture, const QImage &image, const QVector<QRect> &rects, bool mipmaps,
+                                const QVector<Region> &extra)
+{
+    for (int i = 0; i < rects.size(); ++i)
+        updateSubImage(texture, image, rects.at(i), false);
+
+    for (int i = 0; i < extra.size(); ++i)
+        updateSubImage(texture, extra.at(i).pixels, extra.at(i).pos, extra.at(i).level);
+
+    if (mipmaps) {
+        GLState::bindTexture(texture);
+        QOpenGLContext::currentContext()->functions()->glGenerateMipmap(GL_TEXTURE_2D);
+    }
+}
+
+void TextureUploader::reclaim(bool wait)
+{
+    while (m_count > 0) {
+        Slot &slot = m_slots[m_head];
+
+        if (slot.fence) {
+            GLenum result = clientWaitSync(slot.fence, wait ? syncFlushCommandsBit : 0, wait ? 1000000000 : 0);
+            if (result != alreadySignaled && result != conditionSatisfied && !wait)
+                break;
+
+            deleteSync(slot.fence);
+            slot.fence = 0;
+        }
+
+        m_head = (m_head + 1) % RingSize;
+        --m_count;
+
+        if (wait)
+            break;
+    }
+}
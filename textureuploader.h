@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TEXTUREUPLOADER_H
+#define TEXTUREUPLOADER_H
+
+#include <QImage>
+#include <QObject>
+#include <QOpenGLBuffer>
+#include <QRect>
+#include <QVector>
+
+#include <qopengl.h>
+
+class TextureUploader : public QObject
+{
+    Q_OBJECT
+public:
+    TextureUploader(QObject *parent = 0);
+    ~TextureUploader();
+
+    static TextureUploader *instance();
+
+    // pixels to place at pos in a texture level, owned by the caller rather than a client
+    struct Region {
+        int level;
+        QPoint pos;
+        QImage pixels;
+    };
+
+    // uploads the rects of image into texture through a pixel buffer, returns false when
+    // the ring is full and the caller should keep the damage for a later frame,
+    // extra regions such as mip levels land in the same frame as the rects
+    bool upload(GLuint texture, const QImage &image, const QVector<QRect> &rects, bool mipmaps,
+                const QVector<Region> &extra = QVector<Region>());
+
+private:
+    // a pixel buffer the GPU may still be reading from until its fence signals
+    struct Slot {
+        QOpenGLBuffer buffer;
+        void *fence;
+    };
+
+    void uploadNow(GLuint texture, const QImage &image, const QVector<QRect> &rects, bool mipmaps,
+                   const QVector<Region> &extra);
+    void reclaim(bool wait);
+
+    static TextureUploader *m_instance;
+
+    enum { RingSize = 3 };
+
+    Slot m_slots[RingSize];
+    int m_head;
+    int m_count;
+
+    bool m_async;
+};
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "uniformcache.h"
+
+#include "common.h"
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <string.h>
+
+UniformCache::UniformCache()
+    : m_program(0)
+{
+}
+
+void UniformCache::setProgram(QOpenGLShaderProgram *program)
+{
+    m_program = program;
+    invalidate();
+}
+
+void UniformCache::invalidate()
+{
+    m_values.clear();
+    m_keys.clear();
+}
+
+bool UniformCache::unchanged(int location, const float *data, int count)
+{
+    if (location < 0)
+        return true;
+
+    QVector<float> &cached = m_values[location];
+    if (cached.size() == count && !memcmp(cached.constData(), data, count * sizeof(float))) {
+        ++frameStats().uniformUploadsSkipped;
+        return true;
+    }
+
+    cached.resize(count);
+    memcpy(cached.data(), data, count * sizeof(float));
+
+    ++frameStats().uniformUploads;
+    return false;
+}
+
+void UniformCache::setValue(int location, const QMatrix4x4 &value)
+{
+    if (!unchanged(location, value.constData(), 16))
+        m_program->setUniformValue(location, value);
+}
+
+void UniformCache::setValue(int location, const QVector3D &value)
+{
+    const float data[] = { float(value.x()), float(value.y()), float(value.z()) };
+    if (!unchanged(location, data, 3))
+        m_program->setUniformValue(location, value);
+}
+
+void UniformCache::setValue(int location, float x, float y)
+{
+    const float data[] = { x, y };
+    if (!unchanged(location, data, 2))
+        m_program->setUniformValue(location, x, y);
+}
+
+void UniformCache::setValue(int location, float value)
+{
+    if (!unchanged(location, &value, 1))
+        m_program->setUniformValue(location, value);
+}
+
+void UniformCache::setValue(int location, int value)
+{
+    const float data = value;
+    if (!unchanged(location, &data, 1))
+        m_program->setUniformValue(location, value);
+}
+
+void UniformCache::setValueArray(int location, const QVector<QVector3D> &values, int key)
+{
+    if (location < 0)
+        return;
+
+    QHash<int, int>::iterator it = m_keys.find(location);
+    if (it != m_keys.end() && it.value() == key) {
+        ++frameStats().uniformUploadsSkipped;
+        return;
+    }
+
+    m_keys.insert(location, key);
+    ++frameStats().uniformUploads;
+
+    m_program->setUniformValueArray(location, values.constData(), values.size());
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef UNIFORMCACHE_H
+#define UNIFORMCACHE_H
+
+#include <QHash>
+#include <QVector>
+
+class QMatrix4x4;
+class QOpenGLShaderProgram;
+class QVector3D;
+
+// Shadows the uniform values of one shader program so that values which
+// did not change since the last draw are not uploaded again.
+class UniformCache
+{
+public:
+    UniformCache();
+
+    void setProgram(QOpenGLShaderProgram *program);
+
+    void setValue(int location, const QMatrix4x4 &value);
+    void setValue(int location, const QVector3D &value);
+    void setValue(int location, float x, float y);
+    void setValue(int location, float value);
+    void setValue(int location, int value);
+
+    // arrays are compared by key only, e.g. the zone a lights array belongs to
+    void setValueArray(int location, const QVector<QVector3D> &values, int key);
+
+    void invalidate();
+
+private:
+    bool unchanged(int location, const float *data, int count);
+
+    QOpenGLShaderProgram *m_program;
+    QHash<int, QVector<float> > m_values;
+    QHash<int, int> m_keys;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "uploadscheduler.h"
+
+#include "common.h"
+#include "surfaceitem.h"
+
+#include <QTime>
+#include <QtAlgorithms>
+
+#include <float.h>
+
+namespace {
+    // screen area a docked thumbnail is weighted with
+    const qreal thumbnailArea = 64 * 64;
+
+    // hidden surfaces over their backlog only win against other hidden surfaces
+    const qreal backlogArea = 1;
+
+    // waiting damage gains its base priority again every this many milliseconds
+    const qreal agingInterval = 100;
+}
+
+bool UploadScheduler::run(const QList<SurfaceItem *> &mapped, const QList<SurfaceItem *> &docked, SurfaceItem *focus)
+{
+    m_candidates.clear();
+    m_hidden.clear();
+
+    for (int i = 0; i < mapped.size(); ++i) {
+        SurfaceItem *item = mapped.at(i);
+        qreal area = item->takeScreenArea();
+
+        if (!item->hasPendingDamage()) {
+            // an evicted texture is only restored once the surface is drawn again
+            if (item->textureEvicted())
+                m_hidden << item;
+            continue;
+        }
+
+        if (item == focus)
+            add(item, FLT_MAX);
+        else if (area > 0)
+            add(item, area);
+        else if (item->backlogExceeded())
+            add(item, backlogArea);
+        else
+            m_hidden << item;
+    }
+
+    for (int i = 0; i < docked.size(); ++i) {
+        SurfaceItem *item = docked.at(i);
+        if (item->hasPendingDamage() && item->thumbnailDue() && !mapped.contains(item))
+            add(item, item == focus ? FLT_MAX : thumbnailArea);
+    }
+
+    qStableSort(m_candidates.begin(), m_candidates.end(), priorityGreaterThan);
+
+    const qint64 budgetBytes = uploadBudgetBytes();
+    const int budgetMsecs = uploadBudgetMsecs();
+
+    QTime time;
+    time.start();
+
+    qint64 bytes = 0;
+    int uploads = 0;
+    bool carried = false;
+
+    FrameStats &stats = frameStats();
+
+    for (int i = 0; i < m_candidates.size(); ++i) {
+        const Candidate &candidate = m_candidates.at(i);
+
+        // the first upload always goes through so that the highest priority surface makes progress
+        bool overBudget = bytes + candidate.bytes > budgetBytes || time.elapsed() >= budgetMsecs;
+        if (uploads > 0 && overBudget) {
+            ++stats.surfaceUploadsDeferred;
+            carried = true;
+            continue;
+        }
+
+        // a full upload ring asks for a frame by itself once a slot frees up
+        if (!candidate.item->uploadDamage()) {
+            ++stats.surfaceUploadsDeferred;
+            continue;
+        }
+
+        bytes += candidate.bytes;
+        ++uploads;
+        ++stats.surfaceUploads;
+    }
+
+    return carried;
+}
+
+bool UploadScheduler::revealed()
+{
+    bool result = false;
+    for (int i = 0; i < m_hidden.size() && !result; ++i)
+        result = m_hidden.at(i)->screenArea() > 0 && m_hidden.at(i)->hasPendingDamage();
+
+    m_hidden.clear();
+    return result;
+}
+
+void UploadScheduler::add(SurfaceItem *item, qreal priority)
+{
+    Candidate candidate;
+    candidate.item = item;
+    candidate.bytes = item->pendingBytes();
+    candidate.priority = priority == FLT_MAX ? priority : priority * (1 + item->damageAge() / agingInterval);
+    m_candidates << candidate;
+}
+
+bool UploadScheduler::priorityGreaterThan(const Candidate &a, const Candidate &b)
+{
+    return a.priority > b.priority;
+}
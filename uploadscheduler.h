@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef UPLOADSCHEDULER_H
+#define UPLOADSCHEDULER_H
+
+#include <QList>
+#include <QVector>
+
+class SurfaceItem;
+
+class UploadScheduler
+{
+public:
+    // uploads pending surface damage in priority order until the frame's budget is
+    // spent, returns whether damage that is due was carried over to a later frame
+    bool run(const QList<SurfaceItem *> &mapped, const QList<SurfaceItem *> &docked, SurfaceItem *focus);
+
+    // whether a surface skipped by run() as hidden was drawn after all, and its
+    // damage needs another frame, to be called once the frame has been rendered
+    bool revealed();
+
+private:
+    struct Candidate {
+        SurfaceItem *item;
+        qreal priority;
+        qint64 bytes;
+    };
+
+    void add(SurfaceItem *item, qreal priority);
+
+    static bool priorityGreaterThan(const Candidate &a, const Candidate &b);
+
+    QVector<Candidate> m_candidates;
+    QList<SurfaceItem *> m_hidden;
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "vertexarray.h"
+
+#include "common.h"
+#include "glstate.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+namespace {
+    typedef void (QOPENGLF_APIENTRYP GenVertexArrays)(GLsizei n, GLuint *arrays);
+    typedef void (QOPENGLF_APIENTRYP BindVertexArray)(GLuint array);
+
+    GenVertexArrays genVertexArrays = 0;
+    BindVertexArray bindVertexArray = 0;
+
+    void resolve()
+    {
+        static bool resolved = false;
+        if (resolved)
+            return;
+        resolved = true;
+
+        if (!useVertexArrayObjects())
+            return;
+
+        QOpenGLContext *ctx = QOpenGLContext::currentContext();
+
+        if (ctx->hasExtension("GL_OES_vertex_array_object")) {
+            genVertexArrays = reinterpret_cast<GenVertexArrays>(ctx->getProcAddress("glGenVertexArraysOES"));
+            bindVertexArray = reinterpret_cast<BindVertexArray>(ctx->getProcAddress("glBindVertexArrayOES"));
+        } else if (ctx->hasExtension("GL_ARB_vertex_array_object") || ctx->format().majorVersion() >= 3) {
+            genVertexArrays = reinterpret_cast<GenVertexArrays>(ctx->getProcAddress("glGenVertexArrays"));
+            bindVertexArray = reinterpret_cast<BindVertexArray>(ctx->getProcAddress("glBindVertexArray"));
+        }
+
+        if (!genVertexArrays || !bindVertexArray) {
+            genVertexArrays = 0;
+            bindVertexArray = 0;
+        }
+
+        printf("Vertex array objects: %s\n", bindVertexArray ? "yes" : "no");
+    }
+}
+
+VertexArray::VertexArray()
+    : m_id(0)
+{
+}
+
+bool VertexArray::isSupported()
+{
+    resolve();
+    return bindVertexArray != 0;
+}
+
+void VertexArray::bindObject(GLuint id)
+{
+    bindVertexArray(id);
+}
+
+void VertexArray::addAttribute(int location, int size, int stride, int offset)
+{
+    if (location < 0)
+        return;
+
+    Attribute attribute;
+    attribute.location = location;
+    attribute.size = size;
+    attribute.stride = stride;
+    attribute.offset = offset;
+
+    m_attributes << attribute;
+}
+
+void VertexArray::create(const QOpenGLBuffer &vertexBuffer, const QOpenGLBuffer &indexBuffer)
+{
+    m_vertexBuffer = vertexBuffer;
+    m_indexBuffer = indexBuffer;
+
+    if (!isSupported())
+        return;
+
+    genVertexArrays(1, &m_id);
+    GLState::bindVertexArray(m_id);
+
+    QOpenGLFunctions *functions = QOpenGLContext::currentContext()->functions();
+    for (int i = 0; i < m_attributes.size(); ++i)
+        functions->glEnableVertexAttribArray(m_attributes.at(i).location);
+
+    m_vertexBuffer.bind();
+    setAttributePointers();
+
+    // the element array binding is part of the vertex array object
+    if (m_indexBuffer.isCreated())
+        m_indexBuffer.bind();
+
+    GLState::bindVertexArray(0);
+
+    m_vertexBuffer.release();
+}
+
+void VertexArray::setAttributePointers()
+{
+    QOpenGLFunctions *functions = QOpenGLContext::currentContext()->functions();
+    for (int i = 0; i < m_attributes.size(); ++i) {
+        const Attribute &attribute = m_attributes.at(i);
+        functions->glVertexAttribPointer(attribute.location, attribute.size, GL_FLOAT, GL_FALSE,
+                                         attribute.stride, reinterpret_cast<const GLvoid *>(attribute.offset));
+    }
+}
+
+void VertexArray::bind()
+{
+    if (m_id) {
+        GLState::bindVertexArray(m_id);
+        return;
+    }
+
+    int locations[4] = { -1, -1, -1, -1 };
+    for (int i = 0; i < m_attributes.size() && i < 4; ++i)
+        locations[i] = m_attributes.at(i).location;
+
+    GLState::setAttributeArrays(locations[0], locations[1], locations[2], locations[3]);
+
+    m_vertexBuffer.bind();
+    setAttributePointers();
+
+    if (m_indexBuffer.isCreated())
+        m_indexBuffer.bind();
+}
+
+void VertexArray::release()
+{
+    // a bound vertex array object is left for GLState to switch away from
+    if (m_id)
+        return;
+
+    if (m_indexBuffer.isCreated())
+        m_indexBuffer.release();
+
+    m_vertexBuffer.release();
+}
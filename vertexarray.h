@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2012 Samuel Rødal
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERTEXARRAY_H
+#define VERTEXARRAY_H
+
+#include <QOpenGLBuffer>
+#include <QVector>
+
+#include <qopengl.h>
+
+// Captures the attribute setup of static geometry in a vertex array object
+// when the driver has them, and replays the setup by hand otherwise.
+class VertexArray
+{
+public:
+    VertexArray();
+
+    void addAttribute(int location, int size, int stride = 0, int offset = 0);
+    void create(const QOpenGLBuffer &vertexBuffer, const QOpenGLBuffer &indexBuffer = QOpenGLBuffer());
+
+    void bind();
+    void release();
+
+    static bool isSupported();
+    static void bindObject(GLuint id);
+
+private:
+    struct Attribute {
+        int location;
+        int size;
+        int stride;
+        int offset;
+    };
+
+    void setAttributePointers();
+
+    QVector<Attribute> m_attributes;
+
+    QOpenGLBuffer m_vertexBuffer;
+    QOpenGLBuffer m_indexBuffer;
+
+    GLuint m_id;
+};
+
+#endif
@@ -24,9 +24,14 @@
 
 #include "common.h"
 #include "entity.h"
+#include "glstate.h"
 #include "light.h"
 #include "mesh.h"
+#include "portalmesh.h"
+#include "spritebatch.h"
 #include "surfaceitem.h"
+#include "texturepool.h"
+#include "textureuploader.h"
 
 #include "waylandinput.h"
 
@@ -44,15 +49,17 @@
 #include <qmath.h>
 #include <float.h>
 
-static void frameRendered()
+static bool frameRendered()
 {
-    if (!fpsDebug())
-        return;
+    if (!fpsDebug() && !benchmarkMode()) {
+        frameStats().reset();
+        return false;
+    }
 
-    static int frameCount = 0;
     static QTime lastTime = QTime::currentTime();
 
-    ++frameCount;
+    FrameStats &stats = frameStats();
+    ++stats.frames;
 
     const QTime currentTime = QTime::currentTime();
 
@@ -61,12 +68,63 @@ static void frameRendered()
     const int delta = lastTime.msecsTo(currentTime);
 
     if (delta > interval) {
-        qreal fps = 1000.0 * frameCount / delta;
+        qreal fps = 1000.0 * stats.frames / delta;
         qDebug() << "FPS:" << fps;
 
-        frameCount = 0;
+        qDebug() << "Portal traversals:" << stats.planBuilds << "built," << stats.frames - stats.planBuilds << "reused";
+        qDebug() << "GL state changes per frame:" << stats.glStateChanges / stats.frames << "issued,"
+                 << stats.glStateChangesSkipped / stats.frames << "skipped";
+        qDebug() << "Uniform uploads per frame:" << stats.uniformUploads / stats.frames << "issued,"
+                 << stats.uniformUploadsSkipped / stats.frames << "skipped";
+        qDebug() << "Surfaces per frame:" << qreal(stats.surfacesDrawn) / stats.frames << "drawn,"
+                 << qreal(stats.surfacesCulled) / stats.frames << "culled";
+
+        qDebug() << "Texture upload bytes per frame:" << stats.uploadBytes / stats.frames;
+        qDebug() << "Surface uploads per frame:" << qreal(stats.surfaceUploads) / stats.frames << "done,"
+                 << qreal(stats.surfaceUploadsDeferred) / stats.frames << "carried over";
+        qDebug() << "Texture pool:" << stats.texturePoolHits << "hits," << stats.texturePoolMisses << "misses,"
+                 << TexturePool::residentBytes() / 1024 << "KiB resident," << TexturePool::pooledBytes() / 1024 << "KiB pooled,"
+                 << stats.texturesEvicted << "evicted";
+        qDebug() << "Frame callbacks per frame:" << qreal(stats.frameCallbacks) / stats.frames << "sent,"
+                 << qreal(stats.frameCallbacksHeld) / stats.frames << "held back,"
+                 << 1000.0 * stats.frameCallbacksTimed / delta << "per second sent between frames";
+        QHash<const void *, int>::const_iterator callbacks;
+        for (callbacks = stats.surfaceFrameCallbacks.constBegin(); callbacks != stats.surfaceFrameCallbacks.constEnd(); ++callbacks)
+            qDebug() << "    surface" << callbacks.key() << 1000.0 * callbacks.value() / delta << "callbacks per second";
+        QHash<const void *, qint64>::const_iterator it;
+        for (it = stats.surfaceUploadBytes.constBegin(); it != stats.surfaceUploadBytes.constEnd(); ++it)
+            qDebug() << "    surface" << it.key() << it.value() / stats.frames;
+
+        if (benchmarkMode())
+            qDebug() << "Depth reset fill per frame:" << stats.depthResetPixels / stats.frames << "pixels";
+
+        stats.reset();
         lastTime = currentTime;
+        return true;
+    }
+
+    return false;
+}
+
+static qreal projectedArea(const Camera &camera, const QVector<QVector3D> &outline, const QRect &bounds)
+{
+    QPolygonF polygon;
+    for (int i = 0; i < outline.size(); ++i) {
+        if (camera.viewMatrix().map(outline.at(i)).z() > -camera.zNear())
+            return bounds.width() * bounds.height();
+        polygon << camera.toScreen(outline.at(i)).toPointF();
+    }
+
+    polygon = polygon.intersected(QRectF(bounds));
+
+    qreal area = 0;
+    for (int i = 0; i < polygon.size(); ++i) {
+        const QPointF &a = polygon.at(i);
+        const QPointF &b = polygon.at((i + 1) % polygon.size());
+        area += a.x() * b.y() - b.x() * a.y();
     }
+
+    return qAbs(area) * 0.5;
 }
 
 QSurfaceFormat createFormat()
@@ -122,8 +180,14 @@ View::View(const QRect &geometry)
     , m_showInfo(false)
     , m_pressingInfo(false)
     , m_fullscreen(false)
+    , m_polygonDepthReset(true)
+    , m_planDirty(true)
+    , m_frameRatePolicy(new FrameRatePolicy)
     , m_entity(new Entity(this))
 {
+    QTime startupTime;
+    startupTime.start();
+
     m_camera.setPos(QVector3D(2.5, 0, 2.5));
     m_camera.setYaw(0.1);
 
@@ -145,21 +209,22 @@ View::View(const QRect &geometry)
         "varying lowp vec3 n;\n"
         "varying highp vec3 p;\n"
         "varying mediump vec2 t;\n"
+        "BAKED_DECLARATION"
         "void main(void)\n"
         "{\n"
         "    p = vertex.xyz;\n"
         "    t = texCoord;\n"
         "    n = normalize(normal);\n"
+        "BAKED_ASSIGNMENT"
         "    gl_Position = matrix * vertex;\n"
         "}\n";
 
     QByteArray fsrc =
         useSimpleShading() ?
             "uniform sampler2D texture;\n"
-            "uniform int numLights;\n"
             "varying lowp vec3 n;\n"
             "varying highp vec3 p;\n"
-            "uniform highp vec3 lights[NUM_LIGHTS];\n"
+            "LIGHTS_DECLARATION"
             "uniform highp vec3 eye;\n"
             "varying mediump vec2 t;\n"
             "varying highp float light;\n"
@@ -167,24 +232,15 @@ View::View(const QRect &geometry)
             "{\n"
             "    lowp vec3 tex = texture2D(texture, t).rgb;\n"
             "    highp vec3 normal = normalize(n);\n"
-            "    highp float diffuseCoeff = 0.0;\n"
-            "    for (int i = 0; i < NUM_LIGHTS; ++i) {\n"
-            "        highp vec3 toLight = lights[i] - p;\n"
-            "        highp float toLightSqr = dot(toLight, toLight);\n"
-            "        highp float lightDistanceInv = 1.0 / sqrt(toLightSqr);\n"
-            "        highp vec3 toLightN = toLight * lightDistanceInv;\n"
-            "        highp float normalDotLight = dot(toLightN, normal);\n"
-            "        if (i < numLights)\n"
-            "            diffuseCoeff += max(normalDotLight, 0.0) / max(1.5, toLightSqr);\n"
-            "    }\n"
+            "    highp float diffuseCoeff = DIFFUSE_INITIAL;\n"
+            "LIGHTS_LOOP"
             "    gl_FragColor = vec4((1.0 * diffuseCoeff + 0.2) * tex, 1.0);\n"
             "}\n"
         :
             "uniform sampler2D texture;\n"
-            "uniform int numLights;\n"
             "varying lowp vec3 n;\n"
             "varying highp vec3 p;\n"
-            "uniform highp vec3 lights[NUM_LIGHTS];\n"
+            "LIGHTS_DECLARATION"
             "uniform highp vec3 eye;\n"
             "varying mediump vec2 t;\n"
             "varying highp float light;\n"
@@ -195,8 +251,20 @@ View::View(const QRect &geometry)
             "    highp vec3 viewN = normalize(p - eye);\n"
             "    highp float specularFactor = pow(2.0, 10.0 * tex.r);\n"
             "    highp float specular = 0.0;\n"
-            "    highp float diffuseCoeff = 0.0;\n"
-            "    for (int i = 0; i < NUM_LIGHTS; ++i) {\n"
+            "    highp float diffuseCoeff = DIFFUSE_INITIAL;\n"
+            "LIGHTS_LOOP"
+            "    gl_FragColor = vec4((0.8 * diffuseCoeff + 0.2 + 0.6 * specular) * tex, 1.0);\n"
+            "}\n";
+
+    QByteArray lightSrc =
+        useSimpleShading() ?
+            "        highp vec3 toLight = lights[i] - p;\n"
+            "        highp float toLightSqr = dot(toLight, toLight);\n"
+            "        highp float lightDistanceInv = 1.0 / sqrt(toLightSqr);\n"
+            "        highp vec3 toLightN = toLight * lightDistanceInv;\n"
+            "        highp float normalDotLight = dot(toLightN, normal);\n"
+            "        diffuseCoeff += max(normalDotLight, 0.0) / max(1.5, toLightSqr);\n"
+        :
             "        highp vec3 toLight = lights[i] - p;\n"
             "        highp float toLightSqr = dot(toLight, toLight);\n"
             "        highp float lightDistanceInv = 1.0 / sqrt(toLightSqr);\n"
@@ -204,25 +272,61 @@ View::View(const QRect &geometry)
             "        highp float normalDotLight = dot(toLightN, normal);\n"
             "        highp float reflectionDotView = max(0.0, dot(reflect(toLightN, normal), viewN));\n"
             "        highp float lightScale = min(1.0, lightDistanceInv);\n"
-            "        if (i < numLights) {\n"
-            "            diffuseCoeff += max(normalDotLight, 0.0) / max(1.5, toLightSqr);\n"
-            "            specular += pow(reflectionDotView, specularFactor) * lightScale;\n"
-            "        }\n"
-            "    }\n"
-            "    gl_FragColor = vec4((0.8 * diffuseCoeff + 0.2 + 0.6 * specular) * tex, 1.0);\n"
-            "}\n";
+            "        diffuseCoeff += max(normalDotLight, 0.0) / max(1.5, toLightSqr);\n"
+            "        specular += pow(reflectionDotView, specularFactor) * lightScale;\n";
+
+    QList<QByteArray> attributes;
+    attributes << "vertex" << "normal" << "texCoord";
+
+    if (useBakedLighting()) {
+        // diffuse comes interpolated from the vertices, only specular stays per light
+        vsrc.replace("BAKED_DECLARATION", "attribute highp float lighting;\nvarying highp float light;\n");
+        vsrc.replace("BAKED_ASSIGNMENT", "    light = lighting;\n");
+        fsrc.replace("DIFFUSE_INITIAL", "light");
+        lightSrc = useSimpleShading() ? QByteArray() :
+            "        highp vec3 toLight = lights[i] - p;\n"
+            "        highp float lightDistanceInv = 1.0 / sqrt(dot(toLight, toLight));\n"
+            "        highp vec3 toLightN = toLight * lightDistanceInv;\n"
+            "        highp float reflectionDotView = max(0.0, dot(reflect(toLightN, normal), viewN));\n"
+            "        highp float lightScale = min(1.0, lightDistanceInv);\n"
+            "        specular += pow(reflectionDotView, specularFactor) * lightScale;\n";
+        attributes << "lighting";
+    } else {
+        vsrc.replace("BAKED_DECLARATION", QByteArray());
+        vsrc.replace("BAKED_ASSIGNMENT", QByteArray());
+        fsrc.replace("DIFFUSE_INITIAL", "0.0");
+    }
+
+    // one variant per light count that occurs in the map
+    for (int zone = 0; zone < m_map.numZones(); ++zone) {
+        int count = sceneVariant(zone);
+        if (m_programs.contains(count))
+            continue;
+
+        SceneProgram *program = new SceneProgram;
+        program->program = generateShaderProgram(this, vsrc, specializeLights(fsrc, lightSrc, count), attributes);
+        program->matrixUniform = program->program->uniformLocation("matrix");
+        program->eyeUniform = program->program->uniformLocation("eye");
+        program->lightsUniform = program->program->uniformLocation("lights");
+        program->uniforms.setProgram(program->program);
+
+        m_programs.insert(count, program);
+    }
 
-    fsrc.replace("NUM_LIGHTS", QByteArray::number(m_map.maxLights()));
+    printf("Scene shader variants: %d\n", m_programs.size());
 
-    m_program = generateShaderProgram(this, vsrc, fsrc);
+    m_vertexAttr = 0;
+    m_normalAttr = 1;
+    m_textureAttr = 2;
+    m_lightingAttr = 3;
 
-    m_vertexAttr = m_program->attributeLocation("vertex");
-    m_normalAttr = m_program->attributeLocation("normal");
-    m_textureAttr = m_program->attributeLocation("texCoord");
-    m_matrixUniform = m_program->uniformLocation("matrix");
-    m_eyeUniform = m_program->uniformLocation("eye");
-    m_lightsUniform = m_program->uniformLocation("lights");
-    m_numLightsUniform = m_program->uniformLocation("numLights");
+    int stride = (3 + 3 + 2 + (useBakedLighting() ? 1 : 0)) * 4;
+    m_vertexArray.addAttribute(m_vertexAttr, 3, stride, 0);
+    m_vertexArray.addAttribute(m_normalAttr, 3, stride, 3 * 4);
+    m_vertexArray.addAttribute(m_textureAttr, 2, stride, (3 + 3) * 4);
+    if (useBakedLighting())
+        m_vertexArray.addAttribute(m_lightingAttr, 1, stride, (3 + 3 + 2) * 4);
+    m_vertexArray.create(m_vertexData, m_indexData);
 
     QImage textureImage("boiler_plate.jpg");
     textureImage = textureImage.scaled(256, 256, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
@@ -356,19 +460,20 @@ View::View(const QRect &geometry)
 
         m_ditherId[i] = generateTexture(ditherImage, false);
 
-        glBindTexture(GL_TEXTURE_2D, m_ditherId[i]);
+        GLState::bindTexture(m_ditherId[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     }
 
-    m_program->bind();
+    QOpenGLShaderProgram *program = m_programs.begin().value()->program;
+    program->bind();
 
     GLint value;
-    m_gl.glGetUniformiv(m_program->programId(), m_program->uniformLocation("texture"), &value);
+    m_gl.glGetUniformiv(program->programId(), program->uniformLocation("texture"), &value);
     m_textureUniform = value;
 
     SurfaceItem::initialize(m_map, this);
-    Light::initialize(this);
+    Light::initialize(m_map, this);
     m_entity->initialize();
 
     QPainterPath portalPath;
@@ -378,10 +483,17 @@ View::View(const QRect &geometry)
     portalPath.lineTo(0.25, 0);
     portalPath.lineTo(-0.25, 0);
 
-    QMatrix matrix;
-    matrix.scale(300, 300);
-    m_portalPoly = matrix.inverted().map(portalPath.toFillPolygon(matrix));
-    m_portalRect = m_portalPoly.boundingRect();
+    m_portalMesh.initialize(portalPath, this);
+    m_spriteBatch.initialize(this);
+    m_uploader = new TextureUploader(this);
+    m_portalRect = m_portalMesh.boundingRect();
+
+    m_map.generateVisibility(m_portalRect);
+    updateZoneSurfaces();
+
+    const ShaderStats &shaders = shaderStats();
+    printf("Startup time: %d ms, shaders %d ms (%d programs, %d from cache)\n",
+           startupTime.elapsed(), shaders.msecs, shaders.programs, shaders.cached);
 
     m_time.start();
 
@@ -395,6 +507,16 @@ View::View(const QRect &geometry)
 
     connect(m_focusTimer, SIGNAL(timeout()), this, SLOT(onLongPress()));
 
+    m_thumbnailTimer = new QTimer(this);
+    m_thumbnailTimer->setSingleShot(true);
+    m_thumbnailTimer->setInterval(SurfaceItem::thumbnailInterval());
+    connect(m_thumbnailTimer, SIGNAL(timeout()), this, SLOT(render()));
+
+    // throttled and hidden clients get their callback once it is due, whether or not a frame is rendered
+    m_frameCallbackTimer = new QTimer(this);
+    m_frameCallbackTimer->setSingleShot(true);
+    connect(m_frameCallbackTimer, SIGNAL(timeout()), this, SLOT(frameCallbackTimeout()));
+
     m_animationTimer = new QTimer(this);
     m_animationTimer->setInterval(0);
     m_animationTimer->setSingleShot(true);
@@ -404,6 +526,7 @@ View::View(const QRect &geometry)
 
 View::~View()
 {
+    delete m_frameRatePolicy;
 }
 
 void View::surfaceDestroyed(QObject *object)
@@ -416,6 +539,7 @@ void View::surfaceDestroyed(QObject *object)
 
     m_dockedSurfaces.removeOne(*it);
     m_mappedSurfaces.removeOne(*it);
+    updateZoneSurfaces();
 
     if (m_focus == *it) {
         m_fullscreen = false;
@@ -438,6 +562,7 @@ void View::surfaceDamaged(const QRect &)
         m_surfaces.insert(surface, item);
 
         connect(item, SIGNAL(opacityChanged()), m_animationTimer, SLOT(start()));
+        connect(item, SIGNAL(geometryChanged()), this, SLOT(updateZoneSurfaces()));
 
         m_dockedSurfaces << item;
     }
@@ -491,41 +616,24 @@ bool View::blocked(const QVector3D &pos) const
 Camera View::portalize(const Camera &camera, int portal, bool clip) const
 {
     const Portal *portalA = m_map.portal(portal);
-    const Portal *portalB = portalA->target();
-
-    QVector3D portalUp = QVector3D(0, 1, 0);
-
-    QVector3D portalRightA = QVector3D::crossProduct(portalUp, portalA->normal());
-    QVector3D portalRightB = QVector3D::crossProduct(portalUp, portalB->normal());
-
-    QVector3D deltaA = camera.pos() - portalA->pos();
-
-    qreal dx = QVector3D::dotProduct(deltaA, portalRightA);
-    qreal dy = -QVector3D::dotProduct(deltaA, portalUp);
-    qreal dz = QVector3D::dotProduct(deltaA, portalA->normal());
-
-    QVector3D deltaVA = camera.viewPos() - portalA->pos();
-
-    qreal vdx = QVector3D::dotProduct(deltaVA, portalRightA);
-    qreal vdy = -QVector3D::dotProduct(deltaVA, portalUp);
-    qreal vdz = QVector3D::dotProduct(deltaVA, portalA->normal());
-
-    qreal relativeScale = portalB->scale() / portalA->scale();
-
-    QVector3D pos = portalB->pos() - (dx * portalRightB + dy * portalUp + dz * portalB->normal()) * relativeScale;
-    QVector3D viewPos = portalB->pos() - (vdx * portalRightB + vdy * portalUp + vdz * portalB->normal()) * relativeScale;
-
-    QLineF lineA(QPointF(), -QPointF(portalA->normal().x(), portalA->normal().z()));
-    QLineF lineB(QPointF(), QPointF(portalB->normal().x(), portalB->normal().z()));
 
     Camera result = camera;
-    result.setHeight((viewPos.y() - pos.y()) / (0.4 + camera.viewBob()));
-    result.setPos(pos);
-    result.setYaw(camera.yaw() + lineA.angleTo(lineB));
+    result.setHeight(camera.height() * portalA->relativeScale());
+    result.setPos(portalA->transform().map(camera.pos()));
+    result.setYaw(camera.yaw() + portalA->yawDelta());
 
     if (clip) {
-        QVector4D clip = result.viewMatrix().inverted().transposed().map(QVector4D(portalB->normal(), -QVector3D::dotProduct(portalB->pos(), portalB->normal())));
-        result.setNearClipPlane(clip);
+        // the portal transform is a similarity, rescale to get a rigid view matrix again
+        QMatrix4x4 view = camera.viewMatrix() * portalA->inverseTransform();
+        for (int i = 0; i < 3; ++i)
+            view.setRow(i, view.row(i) * portalA->relativeScale());
+
+        result.setViewMatrix(view);
+
+        // the inverse transpose of a rigid view matrix is known in closed form
+        QVector4D plane = portalA->targetPlane();
+        QVector3D normal = view.mapVector(plane.toVector3D());
+        result.setNearClipPlane(QVector4D(normal, plane.w() - QVector3D::dotProduct(normal, view.column(3).toVector3D())));
     }
 
     return result;
@@ -538,9 +646,7 @@ void View::move(Camera &camera, const QVector3D &pos)
 
     for (int i = 0; i < m_map.numPortals(); ++i) {
         const Portal *portalA = m_map.portal(i);
-
-        QVector3D portalUp = QVector3D(0, 1, 0);
-        QVector3D portalRightA = QVector3D::crossProduct(portalUp, portalA->normal());
+        QVector3D portalRightA = portalA->right();
 
         qreal scale = portalA->scale();
 
@@ -571,23 +677,40 @@ void View::render()
 {
     m_context->makeCurrent(this);
 
+    // the compositor and Qt may have touched GL state since the last frame
+    GLState::reset();
+
+    // whatever did not fit into this frame's budget gets another frame
+    if (m_uploadScheduler.run(m_mappedSurfaces, m_dockedSurfaces, m_focus))
+        m_animationTimer->start();
+
     QSizeF viewport(width(), height());
 
-    glEnable(GL_SCISSOR_TEST);
+    GLState::enable(GL_SCISSOR_TEST);
     glScissor(0, 0, width(), height());
 
-    glEnable(GL_STENCIL_TEST);
+    GLState::enable(GL_STENCIL_TEST);
     glClearStencil(0);
     glStencilMask(~0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    glDisable(GL_DEPTH_TEST);
+    GLState::disable(GL_DEPTH_TEST);
 
     if (m_fullscreen) {
-        drawTexture(QRectF(0, 0, width(), height()), viewport, m_focus->textureId(), 1.0);
+        m_focus->markUsed();
+        m_spriteBatch.add(QRectF(0, 0, width(), height()), m_focus->textureId(), 1.0, m_focus->textureRect());
+        m_spriteBatch.render(viewport);
+
+        // a texture restored after eviction is uploaded by the next frame's scheduler pass
+        if (m_focus->hasPendingDamage())
+            m_animationTimer->start();
 
+        GLState::bindVertexArray(0);
         m_context->swapBuffers(this);
-        WaylandCompositor::frameFinished(m_focus->surface());
+
+        updateFrameRates();
+        sendFrameCallbacks(true);
+        m_textureBudget.enforce(m_surfaces.values());
 
         frameRendered();
 
@@ -670,54 +793,151 @@ void View::render()
     for (int i = 0; i < m_mappedSurfaces.size(); ++i)
         m_mappedSurfaces[i]->setDepthOffset(i * 0.0001);
 
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
+    GLState::enable(GL_DEPTH_TEST);
+    GLState::depthFunc(GL_LEQUAL);
 
     glStencilFunc(GL_EQUAL, 0, ~0);
     glStencilMask(0);
 
-    render(m_camera, QRect(0, 0, width(), height()), m_map.zone(m_camera.pos()));
+    updatePlan();
+    renderPlan();
+
+    // surfaces that came into view were drawn with their old texture
+    if (m_uploadScheduler.revealed())
+        m_animationTimer->start();
 
-    glDisable(GL_SCISSOR_TEST);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_STENCIL_TEST);
+    GLState::disable(GL_SCISSOR_TEST);
+    GLState::disable(GL_DEPTH_TEST);
+    GLState::disable(GL_STENCIL_TEST);
 
-    glDisable(GL_CULL_FACE);
+    GLState::disable(GL_CULL_FACE);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::enable(GL_BLEND);
+    GLState::blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
+    int dragIndex = -1;
     for (int i = 0; i < m_dockedSurfaces.size(); ++i) {
         SurfaceItem *item = m_dockedSurfaces.at(i);
         if (item == m_dragItem) {
-            if (!m_dragAccepted) {
-                drawTexture(dockItemRect(i).translated(m_dragItemDelta), viewport, item->textureId(), 0.5);
-            }
+            dragIndex = i;
         } else {
-            drawTexture(dockItemRect(i), viewport, item->textureId(), 0.5);
+            item->markUsed();
+            m_spriteBatch.add(dockItemRect(i), item->textureId(), 0.5, item->textureRect());
         }
+
+        // make sure the last update of a thumbnail gets shown
+        if (item->hasPendingDamage() && !m_thumbnailTimer->isActive())
+            m_thumbnailTimer->start();
+    }
+
+    // the dragged item can overlap other dock items, so it goes into a later batch
+    m_spriteBatch.render(viewport);
+
+    if (dragIndex >= 0 && !m_dragAccepted) {
+        m_dragItem->markUsed();
+        m_spriteBatch.add(dockItemRect(dragIndex).translated(m_dragItemDelta), m_dragItem->textureId(), 0.5, m_dragItem->textureRect());
     }
 
     if (m_showInfo) {
-        drawTexture(QRectF(3 * width() / 4 - 64, 2 * height() / 3 - 64, 128, 128), viewport, m_eyeTextureId, m_touchLookId == -1 ? 0.5 : 0.8);
-        drawTexture(QRectF(width() / 4 - 64, 2 * height() / 3 - 64, 128, 128), viewport, m_arrowsTextureId, m_touchMoveId == -1 ? 0.5 : 0.8);
+        m_spriteBatch.add(QRectF(3 * width() / 4 - 64, 2 * height() / 3 - 64, 128, 128), m_eyeTextureId, m_touchLookId == -1 ? 0.5 : 0.8);
+        m_spriteBatch.add(QRectF(width() / 4 - 64, 2 * height() / 3 - 64, 128, 128), m_arrowsTextureId, m_touchMoveId == -1 ? 0.5 : 0.8);
     }
 
-    drawTexture(QRectF(width() - 70, 10, 60, 60), viewport, m_infoTextureId, m_showInfo ? 0.8 : 0.5);
+    m_spriteBatch.add(QRectF(width() - 70, 10, 60, 60), m_infoTextureId, m_showInfo ? 0.8 : 0.5);
+
+    m_spriteBatch.render(viewport);
 
 #if 0
     static int frame = 0;
-    glBlendFunc(GL_ONE, GL_ONE);
+    GLState::blendFunc(GL_ONE, GL_ONE);
     drawTexture(QRectF(0, 0, width(), height()), viewport, m_ditherId[frame % 4], 1.0, QRectF(0, 0, width() / 2, height() / 2));
     ++frame;
 #endif
 
-    glDisable(GL_BLEND);
+    GLState::disable(GL_BLEND);
 
+    // keep the compositor's buffer bindings from ending up in one of our vertex array objects
+    GLState::bindVertexArray(0);
     m_context->swapBuffers(this);
-    WaylandCompositor::frameFinished();
 
-    frameRendered();
+    updateFrameRates();
+    sendFrameCallbacks(true);
+    m_textureBudget.enforce(m_surfaces.values());
+
+    if (frameRendered() && benchmarkMode()) {
+        qDebug() << "Measured with depth reset through" << (m_polygonDepthReset ? "portal polygon" : "window rect");
+        m_polygonDepthReset = !m_polygonDepthReset;
+    }
+
+    if (benchmarkMode())
+        m_animationTimer->start();
+}
+
+void View::frameCallbackTimeout()
+{
+    sendFrameCallbacks(false);
+}
+
+void View::sendFrameCallbacks(bool rendered)
+{
+    FrameStats &stats = frameStats();
+
+    int next = -1;
+    for (SurfaceHash::const_iterator it = m_surfaces.constBegin(); it != m_surfaces.constEnd(); ++it) {
+        SurfaceItem *item = it.value();
+
+        // full rate surfaces are paced by rendered frames only
+        const int interval = item->frameCallbackInterval();
+        if (!rendered && interval == 0)
+            continue;
+
+        int remaining = item->frameCallbackRemaining();
+        if (remaining == 0) {
+            WaylandCompositor::frameFinished(it.key());
+            item->frameCallbackSent();
+            remaining = interval;
+
+            ++stats.surfaceFrameCallbacks[it.key()];
+            if (rendered)
+                ++stats.frameCallbacks;
+            else
+                ++stats.frameCallbacksTimed;
+        } else if (rendered) {
+            ++stats.frameCallbacksHeld;
+        }
+
+        if (interval > 0 && (next < 0 || remaining < next))
+            next = remaining;
+    }
+
+    // one timer serves the throttled and hidden surfaces alike, armed for whichever is due first
+    if (next >= 0 && (!m_frameCallbackTimer->isActive() || m_frameCallbackTimer->remainingTime() > next))
+        m_frameCallbackTimer->start(next);
+}
+
+void View::updateFrameRates()
+{
+    const qreal viewArea = qreal(width()) * height();
+
+    for (SurfaceHash::const_iterator it = m_surfaces.constBegin(); it != m_surfaces.constEnd(); ++it) {
+        SurfaceItem *item = it.value();
+
+        FrameRatePolicy::Surface surface;
+        surface.drawn = item->used();
+        surface.focused = item == m_focus;
+        surface.docked = m_dockedSurfaces.contains(item);
+        surface.screenArea = m_fullscreen && surface.focused ? viewArea : item->screenArea();
+        surface.screenFraction = viewArea > 0 ? surface.screenArea / viewArea : 0;
+        surface.distance = item->distance();
+
+        item->setFrameCallbackInterval(FrameRatePolicy::interval(m_frameRatePolicy->tier(surface)));
+    }
+}
+
+void View::setFrameRatePolicy(FrameRatePolicy *policy)
+{
+    delete m_frameRatePolicy;
+    m_frameRatePolicy = policy;
 }
 
 void split(const QRectF &rect, int depth, QRectF *left, QRectF *right)
@@ -766,64 +986,41 @@ bool visibleFrom(const Camera &camera, const QRectF &r)
 #endif
 }
 
-void View::render(const Camera &camera, const QRect &currentBounds, int zone, int depth)
+void View::updatePlan()
 {
-    glFrontFace(GL_CW);
-    glCullFace(GL_BACK);
-    glEnable(GL_CULL_FACE);
-
-#ifndef QT_OPENGL_ES_2
-    if (m_wireframe)
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-#endif
-
-    m_program->bind();
-    m_program->setUniformValue(m_matrixUniform, camera.viewProjectionMatrix());
-    m_program->setUniformValue(m_eyeUniform, camera.viewPos());
-    m_program->setUniformValueArray(m_lightsUniform, m_map.lights(zone).constData(), m_map.lights(zone).size());
-    m_program->setUniformValue(m_numLightsUniform, m_map.lights(zone).size());
-
-    glActiveTexture(GL_TEXTURE0 + m_textureUniform);
-    glBindTexture(GL_TEXTURE_2D, m_textureId);
-
-    m_vertexData.bind();
-
-    int stride = (3 + 3 + 2) * 4;
-    m_program->enableAttributeArray(m_vertexAttr);
-    m_program->setAttributeBuffer(m_vertexAttr, GL_FLOAT, 0, 3, stride);
-    m_program->enableAttributeArray(m_normalAttr);
-    m_program->setAttributeBuffer(m_normalAttr, GL_FLOAT, 3 * 4, 3, stride);
-    m_program->enableAttributeArray(m_textureAttr);
-    m_program->setAttributeBuffer(m_textureAttr, GL_FLOAT, (3 + 3) * 4, 2, stride);
-
-    m_indexData.bind();
-    int offset = m_indexBufferOffsets.at(zone).first;
-    int size = m_indexBufferOffsets.at(zone).second;
-
-    glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_SHORT, reinterpret_cast<GLvoid *>(offset * 2));
-    m_indexData.release();
-
-    m_vertexData.release();
-
-    m_program->disableAttributeArray(m_textureAttr);
-    m_program->disableAttributeArray(m_normalAttr);
-    m_program->disableAttributeArray(m_vertexAttr);
-
-    for (int i = 0; i < m_mappedSurfaces.size(); ++i) {
-        m_mappedSurfaces.at(i)->render(m_map, camera);
+    if (!m_planDirty
+        && m_planSize == size()
+        && m_planPos == m_camera.pos()
+        && m_planMatrix == m_camera.viewProjectionMatrix())
+    {
+        return;
     }
 
-    glCullFace(GL_FRONT);
+    m_plan.clear();
+    plan(m_camera, QRect(0, 0, width(), height()), m_map.zone(m_camera.pos()));
 
-    for (int i = 0; i < m_map.lights(zone).size(); ++i)
-        Light(zone, i).render(m_map, camera);
+    m_planDirty = false;
+    m_planSize = size();
+    m_planPos = m_camera.pos();
+    m_planMatrix = m_camera.viewProjectionMatrix();
 
-#ifndef QT_OPENGL_ES_2
-    if (m_wireframe)
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-#endif
+    ++frameStats().planBuilds;
+}
 
-    if (depth < 3) {
+void View::plan(const Camera &camera, const QRect &currentBounds, int zone, int depth, quint64 chain)
+{
+    RenderStep step;
+    step.type = RenderStep::DrawZone;
+    step.zone = zone;
+    step.portal = -1;
+    step.level = 0;
+    step.depth = depth;
+    step.bounds = currentBounds;
+    step.camera = camera;
+
+    m_plan << step;
+
+    if (depth < m_map.maxPortalDepth()) {
         for (int i = 0; i < m_map.numPortals(); ++i) {
             const Portal *portalA = m_map.portal(i);
             const Portal *portalB = portalA->target();
@@ -831,9 +1028,11 @@ void View::render(const Camera &camera, const QRect &currentBounds, int zone, in
             if (!portalB || m_map.zone(portalA->pos()) != zone)
                 continue;
 
-            QVector3D portalUp = QVector3D(0, 1, 0);
+            quint64 portalChain = Map::portalChain(chain, i);
+            if (!m_map.potentiallyVisible(m_camera.pos(), portalChain))
+                continue;
 
-            QVector3D portalRightA = QVector3D::crossProduct(portalUp, portalA->normal());
+            QVector3D portalRightA = portalA->right();
 
             qreal dist = QVector3D::dotProduct(camera.pos() - portalA->pos(), portalA->normal());
 
@@ -844,63 +1043,200 @@ void View::render(const Camera &camera, const QRect &currentBounds, int zone, in
                 (QVector4D::dotProduct(camera.nearClipPlane(), QVector4D(portalEdgeLeft, 1)) > camera.zNear()
                  || QVector4D::dotProduct(camera.nearClipPlane(), QVector4D(portalEdgeRight, 1)) > camera.zNear()))
             {
-                qreal scale = portalA->scale();
+                const QMatrix4x4 &transform = portalA->outlineTransform();
 
-                QVector<QVector3D> portal;
-                for (int j = 0; j < m_portalPoly.size(); ++j) {
-                    portal << QVector3D(portalA->pos().x(), scale * m_portalPoly.at(j).y(), portalA->pos().z()) - scale * m_portalPoly.at(j).x() * portalRightA;
-                }
+                QVector<QVector3D> bounds;
+                bounds << transform.map(QVector3D(m_portalRect.topLeft()))
+                       << transform.map(QVector3D(m_portalRect.topRight()))
+                       << transform.map(QVector3D(m_portalRect.bottomRight()))
+                       << transform.map(QVector3D(m_portalRect.bottomLeft()));
 
-                QRect newBounds = camera.toScreenRect(portal).toAlignedRect() & currentBounds;
+                QRect newBounds = camera.toScreenRect(bounds).toAlignedRect() & currentBounds;
 
                 if (newBounds.isNull())
                     continue;
 
-                QRect oldScissor = QRectF(currentBounds.x(), height() - (currentBounds.y() + currentBounds.height()), currentBounds.width(), currentBounds.height()).toAlignedRect();
-                QRect newScissor = QRectF(newBounds.x(), height() - (newBounds.y() + newBounds.height()), newBounds.width(), newBounds.height()).toAlignedRect();
+                step.type = RenderStep::EnterPortal;
+                step.zone = zone;
+                step.portal = i;
+                step.level = m_portalMesh.levelForSize(qMax(newBounds.width(), newBounds.height()));
+                step.depth = depth;
+                step.bounds = newBounds;
+                step.camera = camera;
 
-                glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
-                glStencilMask(~0);
+                m_plan << step;
 
-                glColorMask(false, false, false, false);
-                drawConvexSolid(camera, portal, Qt::red);
+                plan(portalize(camera, i), newBounds, m_map.zone(portalB->pos()), depth + 1, portalChain);
 
-                glStencilMask(0);
+                step.type = RenderStep::LeavePortal;
+                step.bounds = currentBounds;
 
-                glScissor(newScissor.x(), newScissor.y(), newScissor.width(), newScissor.height());
-                glStencilFunc(GL_EQUAL, depth + 1, ~0);
+                m_plan << step;
+            }
+        }
+    }
 
-                glDepthFunc(GL_ALWAYS);
-                drawRect(QRectF(0, 0, width(), height()), QSizeF(width(), height()), Qt::black, 1.0);
-                glColorMask(true, true, true, true);
-                glDepthFunc(GL_LEQUAL);
+    if (m_camera.pos() != camera.pos() && zone == m_map.zone(m_camera.pos())) {
+        step.type = RenderStep::DrawEntity;
+        step.zone = zone;
+        step.portal = -1;
+        step.level = 0;
+        step.depth = depth;
+        step.bounds = currentBounds;
+        step.camera = camera;
+
+        m_plan << step;
+    }
+}
+
+QRect View::toScissor(const QRect &bounds) const
+{
+    return QRectF(bounds.x(), height() - (bounds.y() + bounds.height()), bounds.width(), bounds.height()).toAlignedRect();
+}
+
+void View::renderPlan()
+{
+    for (int i = 0; i < m_plan.size(); ++i) {
+        const RenderStep &step = m_plan.at(i);
+        const Camera &camera = step.camera;
+
+        switch (step.type) {
+        case RenderStep::DrawZone:
+            renderZone(camera, step.zone, step.bounds);
+            break;
+        case RenderStep::EnterPortal:
+        {
+            const QMatrix4x4 &transform = m_map.portal(step.portal)->outlineTransform();
+            QRect newScissor = toScissor(step.bounds);
+
+            glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+            glStencilMask(~0);
 
-                render(portalize(camera, i), newBounds, m_map.zone(portalB->pos()), depth + 1);
+            GLState::colorMask(false);
+            m_portalMesh.render(camera, transform, step.level);
 
-                glStencilFunc(GL_EQUAL, depth + 1, ~0);
-                glStencilOp(GL_KEEP, GL_DECR, GL_DECR);
-                glStencilMask(~0);
+            glStencilMask(0);
+
+            glScissor(newScissor.x(), newScissor.y(), newScissor.width(), newScissor.height());
+            glStencilFunc(GL_EQUAL, step.depth + 1, ~0);
+
+            GLState::depthFunc(GL_ALWAYS);
+            if (m_polygonDepthReset) {
+                // only the stenciled portal area needs its depth pushed to the far plane
+                m_gl.glDepthRangef(1, 1);
+                m_portalMesh.render(camera, transform, step.level);
+                m_gl.glDepthRangef(0, 1);
+            } else {
+                drawRect(QRectF(0, 0, width(), height()), QSizeF(width(), height()), Qt::black, 1.0);
+            }
+            GLState::colorMask(true);
+            GLState::depthFunc(GL_LEQUAL);
 
-                glDepthFunc(GL_ALWAYS);
-                glColorMask(false, false, false, false);
-                drawConvexSolid(camera, portal, Qt::red);
-                glColorMask(true, true, true, true);
-                glDepthFunc(GL_LEQUAL);
+            if (benchmarkMode()) {
+                QVector<QVector3D> outline;
+                foreach (const QPointF &point, m_portalMesh.outline())
+                    outline << transform.map(QVector3D(point));
 
-                glScissor(oldScissor.x(), oldScissor.y(), oldScissor.width(), oldScissor.height());
-                glStencilFunc(GL_EQUAL, depth, ~0);
+                frameStats().depthResetPixels += m_polygonDepthReset ? projectedArea(camera, outline, step.bounds) : step.bounds.width() * step.bounds.height();
             }
+            break;
+        }
+        case RenderStep::LeavePortal:
+        {
+            const QMatrix4x4 &transform = m_map.portal(step.portal)->outlineTransform();
+            QRect oldScissor = toScissor(step.bounds);
+
+            glStencilFunc(GL_EQUAL, step.depth + 1, ~0);
+            glStencilOp(GL_KEEP, GL_DECR, GL_DECR);
+            glStencilMask(~0);
+
+            GLState::depthFunc(GL_ALWAYS);
+            GLState::colorMask(false);
+            m_portalMesh.render(camera, transform, step.level);
+            GLState::colorMask(true);
+            GLState::depthFunc(GL_LEQUAL);
+
+            glScissor(oldScissor.x(), oldScissor.y(), oldScissor.width(), oldScissor.height());
+            glStencilFunc(GL_EQUAL, step.depth, ~0);
+            break;
+        }
+        case RenderStep::DrawEntity:
+            GLState::disable(GL_CULL_FACE);
+            GLState::depthMask(false);
+            m_entity->updateTransform(camera);
+            m_entity->render(m_map, camera);
+            GLState::depthMask(true);
+            GLState::enable(GL_CULL_FACE);
+            break;
         }
     }
+}
 
-    if (m_camera.pos() != camera.pos() && zone == m_map.zone(m_camera.pos())) {
-        glDisable(GL_CULL_FACE);
-        glDepthMask(false);
-        m_entity->updateTransform(camera);
-        m_entity->render(m_map, camera);
-        glDepthMask(true);
-        glEnable(GL_CULL_FACE);
+void View::updateZoneSurfaces()
+{
+    m_zoneSurfaces.fill(QList<SurfaceItem *>(), m_map.numZones());
+
+    // keep the stacking order of m_mappedSurfaces within each zone
+    for (int i = 0; i < m_mappedSurfaces.size(); ++i) {
+        SurfaceItem *item = m_mappedSurfaces.at(i);
+        int zone = m_map.zone(item->vertices().at(0));
+        if (zone >= 0)
+            m_zoneSurfaces[zone] << item;
+    }
+}
+
+void View::renderZone(const Camera &camera, int zone, const QRect &bounds)
+{
+    GLState::frontFace(GL_CW);
+    GLState::cullFace(GL_BACK);
+    GLState::enable(GL_CULL_FACE);
+
+#ifndef QT_OPENGL_ES_2
+    if (m_wireframe)
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+#endif
+
+    const QVector<QVector3D> lights = m_map.lights(zone);
+    SceneProgram *program = m_programs.value(sceneVariant(zone));
+
+    GLState::useProgram(program->program);
+    program->uniforms.setValue(program->matrixUniform, camera.viewProjectionMatrix());
+    program->uniforms.setValue(program->eyeUniform, camera.viewPos());
+
+    // lights are static, so the array only needs uploading when the zone changes
+    program->uniforms.setValueArray(program->lightsUniform, lights, zone);
+
+    GLState::activeTexture(GL_TEXTURE0 + m_textureUniform);
+    GLState::bindTexture(m_textureId);
+
+    m_vertexArray.bind();
+
+    int offset = m_indexBufferOffsets.at(zone).first;
+    int size = m_indexBufferOffsets.at(zone).second;
+
+    glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_SHORT, reinterpret_cast<GLvoid *>(offset * 2));
+
+    m_vertexArray.release();
+
+    const QList<SurfaceItem *> &surfaces = m_zoneSurfaces.at(zone);
+    for (int i = 0; i < surfaces.size(); ++i) {
+        SurfaceItem *item = surfaces.at(i);
+        if (camera.toScreenRect(item->vertices()).intersects(bounds)) {
+            item->render(m_map, camera, zone);
+            ++frameStats().surfacesDrawn;
+        } else {
+            ++frameStats().surfacesCulled;
+        }
     }
+
+    GLState::cullFace(GL_FRONT);
+
+    Light::render(zone, camera);
+
+#ifndef QT_OPENGL_ES_2
+    if (m_wireframe)
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+#endif
 }
 
 void View::exposeEvent(QExposeEvent *)
@@ -912,6 +1248,7 @@ void View::resizeEvent(QResizeEvent *)
 {
     glViewport(0, 0, width(), height());
     m_camera.setViewSize(size());
+    m_planDirty = true;
     m_animationTimer->start();
 }
 
@@ -983,6 +1320,25 @@ void View::generateScene()
         m_vertexBuffer << meshVertexBuffer;
         m_texCoordBuffer << meshTexCoordBuffer;
 
+        if (useBakedLighting()) {
+            // same diffuse term as the scene shader, evaluated once per vertex
+            const QVector<QVector3D> lights = m_map.lights(i);
+            for (int j = 0; j < meshVertexBuffer.size(); ++j) {
+                QVector3D p = meshVertexBuffer.at(j);
+                QVector3D normal = meshNormalBuffer.at(j).normalized();
+
+                qreal diffuse = 0;
+                for (int k = 0; k < lights.size(); ++k) {
+                    QVector3D toLight = lights.at(k) - p;
+                    qreal toLightSqr = QVector3D::dotProduct(toLight, toLight);
+                    qreal normalDotLight = QVector3D::dotProduct(toLight.normalized(), normal);
+                    diffuse += qMax(normalDotLight, qreal(0)) / qMax(qreal(1.5), toLightSqr);
+                }
+
+                m_lightingBuffer << diffuse;
+            }
+        }
+
         QVector<QVector2D> texCoordBuffer(mesh.vertexBuffer().size());
 
         for (int i = indexOffset; i < m_indexBuffer.size(); ++i)
@@ -1001,6 +1357,8 @@ void View::generateScene()
         interleaved << m_normalBuffer.at(i).z();
         interleaved << m_texCoordBuffer.at(i).x();
         interleaved << m_texCoordBuffer.at(i).y();
+        if (useBakedLighting())
+            interleaved << m_lightingBuffer.at(i);
     }
 
     int totalSize = interleaved.size() * 4;
@@ -1023,6 +1381,14 @@ void View::generateScene()
     printf("Map triangle count: %d\n", m_indexBuffer.size() / 3);
 }
 
+int View::sceneVariant(int zone) const
+{
+    // with baked lighting the simple shader no longer depends on the lights
+    if (useBakedLighting() && useSimpleShading())
+        return 0;
+    return m_map.lights(zone).size();
+}
+
 void View::resizeTo(const QVector2D &local)
 {
     Q_ASSERT(m_focus);
@@ -1200,6 +1566,7 @@ void View::startFocus()
 
     m_mappedSurfaces.removeOne(m_focus);
     m_mappedSurfaces << m_focus;
+    updateZoneSurfaces();
 }
 
 void View::updateWalking(const QPoint &touch)
@@ -1301,6 +1668,8 @@ void View::updateDrag(const QPoint &pos)
             m_dockedSurfaces << m_dragItem;
     }
 
+    updateZoneSurfaces();
+
     m_animationTimer->start();
 }
 
@@ -23,6 +23,7 @@
 #ifndef VIEW_H
 #define VIEW_H
 
+#include <QHash>
 #include <QOpenGLBuffer>
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
@@ -35,7 +36,14 @@
 #include <QVector3D>
 
 #include "camera.h"
+#include "frameratepolicy.h"
 #include "map.h"
+#include "portalmesh.h"
+#include "spritebatch.h"
+#include "texturebudget.h"
+#include "uniformcache.h"
+#include "uploadscheduler.h"
+#include "vertexarray.h"
 
 #include "waylandcompositor.h"
 #include "waylandsurface.h"
@@ -43,6 +51,7 @@
 class Entity;
 class Light;
 class SurfaceItem;
+class TextureUploader;
 class QOpenGLFramebufferObject;
 
 class QOpenGLWindow : public QWindow
@@ -62,13 +71,18 @@ public:
     View(const QRect &geometry);
     ~View();
 
+    // takes ownership of policy
+    void setFrameRatePolicy(FrameRatePolicy *policy);
+
 public slots:
     void render();
     void onLongPress();
 
 private slots:
     void surfaceDestroyed(QObject *surface);
+    void frameCallbackTimeout();
     void surfaceDamaged(const QRect &rect);
+    void updateZoneSurfaces();
 
 protected:
     void surfaceCreated(WaylandSurface *surface);
@@ -77,8 +91,31 @@ private:
     void resizeEvent(QResizeEvent *event);
     void exposeEvent(QExposeEvent *event);
     void generateScene();
+    int sceneVariant(int zone) const;
+
+    struct RenderStep {
+        enum Type {
+            DrawZone,
+            EnterPortal,
+            LeavePortal,
+            DrawEntity
+        };
+
+        Type type;
+        int zone;
+        int portal;
+        int level;
+        int depth;
+        QRect bounds;
+        Camera camera;
+    };
+
+    void updatePlan();
+    void plan(const Camera &camera, const QRect &currentBounds, int zone, int depth = 0, quint64 chain = 0);
+    void renderPlan();
+    void renderZone(const Camera &camera, int zone, const QRect &bounds);
 
-    void render(const Camera &camera, const QRect &currentBounds, int zone = 0, int depth = 0);
+    QRect toScissor(const QRect &bounds) const;
 
     void updateDrag(const QPoint &pos);
     void handleTouchEvent(QTouchEvent *event);
@@ -101,6 +138,9 @@ private:
     bool tryMove(QVector3D &pos, const QVector3D &delta) const;
     void move(Camera &camera, const QVector3D &pos);
 
+    void updateFrameRates();
+    void sendFrameCallbacks(bool rendered);
+
     QRectF dockItemRect(int i) const;
     SurfaceItem *dockItemAt(const QPoint &pos);
 
@@ -128,17 +168,26 @@ private:
 
     Camera portalize(const Camera &camera, int portal, bool clip = true) const;
 
+    struct SceneProgram {
+        QOpenGLShaderProgram *program;
+        UniformCache uniforms;
+
+        uint matrixUniform;
+        uint eyeUniform;
+        uint lightsUniform;
+    };
+
     uint m_vertexAttr;
     uint m_normalAttr;
     uint m_textureAttr;
-    uint m_matrixUniform;
+    uint m_lightingAttr;
     uint m_textureUniform;
     uint m_rustUniform;
     uint m_wallUniform;
     uint m_noiseUniform;
-    uint m_eyeUniform;
-    uint m_lightsUniform;
-    uint m_numLightsUniform;
+
+    // scene shader variants keyed by the number of lights in a zone
+    QHash<int, SceneProgram *> m_programs;
 
     uint m_eyeTextureId;
     uint m_arrowsTextureId;
@@ -149,13 +198,13 @@ private:
 
     QOpenGLContext *m_context;
     QOpenGLFunctions m_gl;
-    QOpenGLShaderProgram *m_program;
 
     Camera m_camera;
 
     QVector<QVector3D> m_normalBuffer;
     QVector<QVector3D> m_vertexBuffer;
     QVector<QVector2D> m_texCoordBuffer;
+    QVector<float> m_lightingBuffer;
     QVector<ushort> m_indexBuffer;
     QVector<QPair<int, int> > m_indexBufferOffsets;
 
@@ -178,17 +227,23 @@ private:
     SurfaceHash m_surfaces;
 
     QList<SurfaceItem *> m_mappedSurfaces;
+    QVector<QList<SurfaceItem *> > m_zoneSurfaces;
     QList<SurfaceItem *> m_dockedSurfaces;
 
     Map m_map;
     WaylandInputDevice *m_input;
     SurfaceItem *m_focus;
     QVector2D m_resizeGrip;
-    QPolygonF m_portalPoly;
+    PortalMesh m_portalMesh;
+    SpriteBatch m_spriteBatch;
+    TextureUploader *m_uploader;
+    UploadScheduler m_uploadScheduler;
+    TextureBudget m_textureBudget;
     QRectF m_portalRect;
 
     QOpenGLBuffer m_vertexData;
     QOpenGLBuffer m_indexData;
+    VertexArray m_vertexArray;
 
     SurfaceItem *m_dragItem;
 
@@ -204,12 +259,22 @@ private:
     bool m_showInfo;
     bool m_pressingInfo;
     bool m_fullscreen;
+    bool m_polygonDepthReset;
+
+    QVector<RenderStep> m_plan;
+    bool m_planDirty;
+    QSize m_planSize;
+    QVector3D m_planPos;
+    QMatrix4x4 m_planMatrix;
 
     QPoint m_mousePos;
 
     QHash<int, bool> m_occupiedTiles;
     QTimer *m_focusTimer;
     QTimer *m_fullscreenTimer;
+    QTimer *m_thumbnailTimer;
+    QTimer *m_frameCallbackTimer;
+    FrameRatePolicy *m_frameRatePolicy;
     QTimer *m_animationTimer;
     Entity *m_entity;
 };